@@ -3,7 +3,8 @@
    The program will execute until the system achieves legal configuration or indefinately.
 
    TERMS:
-        Neighborhood: The neighborhood of a node is the node and its right and left values.
+        Neighborhood: The neighborhood of a node is the node and its neighbors in the topology
+                      (its right and left values in a linked list).
         Local Leader: A node is the local leader if the value of its secondary variable is greater or equal to those of its neighbors.
         Legal Configuration: The system has assumed a legal configuration when the primary values of all nodes are equal.
 
@@ -21,10 +22,41 @@
 
    (3) If none of the primary values are equal between the node and its neighbors, the node.primary updates.
 
-   Data structure to be first investigated is the linked list. */
+   Data structure to be first investigated is the linked list; System accepts any topology. */
 
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <array>
+#include <utility>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <csignal>
+#include <cctype>
+#include <cmath>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <time.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
@@ -32,272 +64,6976 @@ using namespace std;
 
 const int M = 20;   // Arbitrary variable for stabilization algorithm.
 
+/* Constants of the rules: the M added by 2a, the increment of 2b and the initial secondary.
+   Defaults are the values the algorithm was written with; tune mode searches for better ones. */
+
+struct RuleConstants {
+    int m;
+    int increment;
+    int initial;
+
+    static RuleConstants Default(){
+        RuleConstants constants = { M, 1, 5 };
+        return constants;
+    }
+};
+
 class Node;
 
-/* Node class.
-   Contains primary and secondary variables for stabilization logic.
-   Each node is connected in a linked list. */
+/* Xorshift64* pseudo random generator.
+   Each engine owns one so trials do not contend on the global rand() state. */
 
-class Node {
+class Random {
 private:
-    int primary;      // Primary attribute
-    int secondary;    // Secondary attribute
-    Node* left;       // Left neighbor
-    Node* right;      // Right neighbor
+    uint64_t state;
 
 public:
-    /* Default constructor. */
-
-    Node(){
-        primary = 0;
-        secondary = 5;  // Arbitrary value
-        left = NULL;
-        right = NULL;
+    Random(uint64_t seed = 1){
+        Seed(seed);
     }
 
-    /* Compares the primary variables of two nodes.
-       Returns true when the two primary values are equal. */
+    /* Reseeds the generator. A zero state is never produced. */
 
-    bool Equal(const Node other){
-        if (primary == other.primary){
-            return true;
+    void Seed(uint64_t seed){
+        state = (seed + 1) * 0x9E3779B97F4A7C15ULL;
+        if (state == 0){
+            state = 1;
         }
-        return false;
     }
 
-    /* Updates the primary value of the node.
-       In our system this will simply flip the value. */
+    uint64_t Next(){
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
 
-    void Update(){
-        if (primary == 0){
-            primary = 1;
-        }
-        else {
-            primary = 0;
+    /* Returns a value in [0, n). */
+
+    int Below(int n){
+        return (int)(((Next() >> 32) * (uint64_t)n) >> 32);
+    }
+};
+
+/* Mixes a seed with two indices so every chunk of a sweep has its own reproducible stream. */
+
+uint64_t MixSeed(uint64_t seed, uint64_t a, uint64_t b){
+    uint64_t x = seed ^ (a * 0x9E3779B97F4A7C15ULL) ^ (b * 0xC2B2AE3D27D4EB4FULL);
+
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* Splits [0, n) into one contiguous range per thread and runs body(thread, begin, end)
+   on each, the first range on the calling thread. */
+
+void ParallelFor(int threads, int64_t n, const function<void(int, int64_t, int64_t)>& body){
+    vector<thread> workers;
+
+    threads = (int)max((int64_t)1, min((int64_t)threads, n));
+    for (int t = 1; t < threads; t++){
+        workers.push_back(thread(body, t, n * t / threads, n * (t + 1) / threads));
+    }
+    body(0, 0, n / threads);
+    for (size_t t = 0; t < workers.size(); t++){
+        workers[t].join();
+    }
+}
+
+/* CPUs this process may run on, read once before any thread is pinned. */
+
+const vector<int>& AllowedCpus(){
+    static vector<int> cpus = [](){
+        vector<int> allowed;
+        cpu_set_t set;
+
+        if (sched_getaffinity(0, sizeof(set), &set) == 0){
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+                if (CPU_ISSET(cpu, &set)){
+                    allowed.push_back(cpu);
+                }
+            }
         }
+        return allowed;
+    }();
+    return cpus;
+}
+
+/* Pins the calling thread to the indexth allowed CPU, cycling when there are fewer CPUs
+   than threads. Returns false when affinity cannot be set. */
+
+bool PinThread(int index){
+    const vector<int>& cpus = AllowedCpus();
+    cpu_set_t set;
+
+    if (cpus.empty()){
+        return false;
     }
+    CPU_ZERO(&set);
+    CPU_SET(cpus[index % cpus.size()], &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
 
-    /* Prints primary variable to standard output. */
+/* Lets the calling thread run on every allowed CPU again. */
 
-    void Print(){
-        cout << primary << ' ';
+void UnpinThread(){
+    const vector<int>& cpus = AllowedCpus();
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    for (size_t c = 0; c < cpus.size(); c++){
+        CPU_SET(cpus[c], &set);
+    }
+    if (!cpus.empty()){
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
     }
+}
 
-    friend class System;
-};
+/* Undirected graph in compressed sparse row form.
+   Neighbors of node i are adjacency[offset[i]] .. adjacency[offset[i + 1] - 1], sorted.
+   Storage is either owned or a read-only view of a mapped cache file; named int sections
+   (reorderings, colorings, partitions) travel with the graph. */
 
-class System {
+class Graph {
 private:
-    int SYSTEM_SIZE;	// Number of Nodes in system
-    Node* member;    	// Array of Nodes
-    Node* node;         // Pointer to the current node
+    int nodes;                          // Number of nodes
+    int64_t arcs;                       // Number of adjacency entries (twice the edges)
+    const int64_t* offset;
+    const int* adjacency;
+    vector<int64_t> ownedOffset;
+    vector<int> ownedAdjacency;
+    map<string, vector<int> > ownedSections;
+    map<string, pair<const int*, int64_t> > sections;
+    void* mapping;                      // Mapped cache file, or NULL when owned
+    size_t mappingSize;
+
+    Graph(const Graph&);
+    Graph& operator=(const Graph&);
 
 public:
-    /* Default constructor.
-       Establishes the relational context of each node with its neighbors. */
+    Graph() : nodes(0), arcs(0), offset(NULL), adjacency(NULL), mapping(NULL), mappingSize(0){}
 
-    System(int _SYSTEM_SIZE){
-        SYSTEM_SIZE = _SYSTEM_SIZE;
-        member = new Node[SYSTEM_SIZE];
-        
-        for (int i = 0; i < SYSTEM_SIZE; i++){
-            if (i == 0){                           // The first node
-                member[i].right = &member[i + 1];
-            }
-            else if (i == SYSTEM_SIZE - 1){        // The last node
-                member[i].left = &member[i - 1];
+    ~Graph(){
+        if (mapping != NULL){
+            munmap(mapping, mappingSize);
+        }
+    }
+
+    /* Takes ownership of CSR arrays. */
+
+    void Assign(vector<int64_t>& _offset, vector<int>& _adjacency){
+        ownedOffset.swap(_offset);
+        ownedAdjacency.swap(_adjacency);
+        nodes = (int)ownedOffset.size() - 1;
+        arcs = ownedAdjacency.size();
+        offset = &ownedOffset[0];
+        adjacency = ownedAdjacency.empty() ? NULL : &ownedAdjacency[0];
+    }
+
+    /* Builds the graph from m edges produced by edge(e, a, b), which sets the endpoints of
+       edge e and may be called more than once per edge. The edges are generated twice,
+       once to count degrees and once to fill the adjacency, so no edge list is stored.
+       Both directions are stored; self loops and duplicate edges are dropped. */
+
+    template <class Generator>
+    static Graph* FromGenerator(int n, int64_t m, const Generator& edge, int threads = 1){
+        vector< atomic<int64_t> > cursor(n + 1);
+        vector<int64_t> start(n + 1, 0);
+        vector<int> fill;
+
+        ParallelFor(threads, n + 1, [&](int, int64_t begin, int64_t end){
+            for (int64_t i = begin; i < end; i++){
+                cursor[i].store(0, memory_order_relaxed);
             }
-            else {
-                member[i].left = &member[i - 1];
-                member[i].right = &member[i + 1];
+        });
+        ParallelFor(threads, m, [&](int, int64_t begin, int64_t end){
+            for (int64_t e = begin; e < end; e++){
+                int a, b;
+
+                edge(e, a, b);
+                if (a != b){
+                    cursor[a].fetch_add(1, memory_order_relaxed);
+                    cursor[b].fetch_add(1, memory_order_relaxed);
+                }
             }
+        });
+        for (int i = 0; i < n; i++){
+            start[i + 1] = start[i] + cursor[i].load(memory_order_relaxed);
+            cursor[i].store(start[i], memory_order_relaxed);
         }
+        fill.resize(start[n]);
+        ParallelFor(threads, m, [&](int, int64_t begin, int64_t end){
+            for (int64_t e = begin; e < end; e++){
+                int a, b;
 
-        node = &member[0];  // Set the node to the first node
+                edge(e, a, b);
+                if (a != b){
+                    fill[cursor[a].fetch_add(1, memory_order_relaxed)] = b;
+                    fill[cursor[b].fetch_add(1, memory_order_relaxed)] = a;
+                }
+            }
+        });
+        return Compact(n, start, fill, threads);
     }
 
-    /* Random scheduler.
-       Directs node* to a random member[]. 
-       The scheduler chooses the ith node. */
+    /* Builds the graph from an undirected edge list. */
 
-    void SelectNode(){
-        int i = rand() % SYSTEM_SIZE;  // Random index
+    static Graph* FromEdges(int n, const vector< pair<int, int> >& edges, int threads = 1){
+        return FromGenerator(n, edges.size(), [&edges](int64_t e, int& a, int& b){
+            a = edges[e].first;
+            b = edges[e].second;
+        }, threads);
+    }
 
-        node = &member[i];  // ith node
+    /* Sorts every adjacency run, removes duplicates and packs the arrays.
+       Sorting makes the result independent of the fill order, hence of the thread count. */
+
+    static Graph* Compact(int n, vector<int64_t>& start, vector<int>& fill, int threads = 1){
+        vector<int64_t> packed(n + 1, 0);
+        vector<int> out;
+        Graph* graph = new Graph();
+
+        ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+            for (int64_t i = begin; i < end; i++){
+                int* first = fill.empty() ? NULL : &fill[0] + start[i];
+                int* last = fill.empty() ? NULL : &fill[0] + start[i + 1];
+
+                sort(first, last);
+                packed[i + 1] = unique(first, last) - first;
+            }
+        });
+        for (int i = 0; i < n; i++){
+            packed[i + 1] += packed[i];
+        }
+        out.resize(packed[n]);
+        ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+            for (int64_t i = begin; i < end; i++){
+                if (packed[i + 1] > packed[i]){
+                    memcpy(&out[packed[i]], &fill[start[i]], (packed[i + 1] - packed[i]) * sizeof(int));
+                }
+            }
+        });
+        graph->Assign(packed, out);
+        return graph;
     }
 
-    /* Simulates a transient fault within the system.
-       Only effects primary variables. */
+    /* Linked list, as built by System. */
 
-    void TransientFault(){
-        SelectNode();
-        node->Update();
+    static Graph* List(int n){
+        vector< pair<int, int> > edges;
+
+        for (int i = 0; i + 1 < n; i++){
+            edges.push_back(make_pair(i, i + 1));
+        }
+        return FromEdges(n, edges);
     }
 
-    /* Checks if the system is in legal configuration.
-       Using the first nodes primary variable as a reference against each other node. */
+    static Graph* Ring(int n){
+        vector< pair<int, int> > edges;
 
-    bool LegalConfig(){
-        for (int i = 1; i < SYSTEM_SIZE; i++){
-            if (!member[0].Equal(member[i])){
-                return false;
-            }
+        for (int i = 0; i < n; i++){
+            edges.push_back(make_pair(i, (i + 1) % n));
         }
-        return true;
+        return FromEdges(n, edges);
     }
 
-    /* Stabilization implementation.
-       Processes until legal configuration condition is met. */
+    /* rows x cols grid, node r * cols + c. */
 
-    void Stabilize(){
-        while (!LegalConfig()){
-            SelectNode();
-            
-            // If true, then (2) is not satisfied.
-            if (!CheckUnequal()){
-                CheckConditions();
+    static Graph* Mesh(int rows, int cols){
+        vector< pair<int, int> > edges;
+
+        for (int r = 0; r < rows; r++){
+            for (int c = 0; c < cols; c++){
+                int i = r * cols + c;
+
+                if (c + 1 < cols){
+                    edges.push_back(make_pair(i, i + 1));
+                }
+                if (r + 1 < rows){
+                    edges.push_back(make_pair(i, i + cols));
+                }
             }
-            //Print();
         }
+        return FromEdges(rows * cols, edges);
+    }
+
+    /* Complete binary tree in heap order: the parent of node i is (i - 1) / 2. */
 
-        cout << "\nSYSTEM LEGAL\n";
+    static Graph* Tree(int n){
+        vector< pair<int, int> > edges;
+
+        for (int i = 1; i < n; i++){
+            edges.push_back(make_pair((i - 1) / 2, i));
+        }
+        return FromEdges(n, edges);
     }
 
-    /* Checks if the secondary values of the nodes in the local neighborhood are unequal.
-       Returns true if there exists a node in the local neighborhood with a primary value
-       not equal to its neighbors primary value. */
+    /* Watts-Strogatz small world: a ring where each node links to its k / 2 successors,
+       with each link rewired to a uniform random target with probability beta.
+       Rewired links that collide with another link are dropped. */
 
-    bool CheckUnequal(){
-        // If the ith node has both left and right neighbors
-        if ((node->left != NULL) && (node->right != NULL)){
-            // If both neighbors have different state, update the node since (3) is satisfied.
-            if ((node->primary != node->left->primary) && (node->primary != node->right->primary)){
-                node->Update();
-                return true;
+    static Graph* WattsStrogatz(int n, int k, double beta, uint64_t seed, int threads = 1){
+        int half = max(1, k / 2);
+
+        return FromGenerator(n, (int64_t)n * half, [=](int64_t e, int& a, int& b){
+            a = e / half;
+            b = (a + (int)(e % half) + 1) % n;
+            if ((MixSeed(seed, e, 1) >> 11) * (1.0 / 9007199254740992.0) < beta){
+                b = (int)(MixSeed(seed, e, 2) % n);
             }
-            // Else if the neighboring nodes all have the same state as the ith, do nothing.
-            else if ((node->primary == node->left->primary) && (node->primary == node->right->primary)){
-                return true;
+        }, threads);
+    }
+
+    /* Barabasi-Albert preferential attachment: nodes 0..m form a clique, and every later
+       node v attaches to m distinct nodes drawn proportionally to degree, i.e. uniformly from
+       the endpoints of the edges of nodes before v; a drawn node v already attaches to is
+       drawn again. Edge e = (v - 1) * m + j is (v, target[e]). The targets depend on earlier
+       ones, so they are drawn in node order from a stream seeded per node, and the result
+       does not depend on the thread count. */
+
+    static Graph* BarabasiAlbert(int n, int m, uint64_t seed, int threads = 1){
+        m = max(1, m);
+        vector<int> target((size_t)max(0, n - 1) * m);
+
+        for (int v = 1; v < n; v++){
+            int64_t first = (int64_t)(v - 1) * m;
+            Random random(MixSeed(seed, v, 3));
+
+            for (int j = 0; j < m; j++){
+                if (v <= m){
+                    target[first + j] = (j < v) ? j : v;    // Clique; spare slots are self loops, which are dropped
+                    continue;
+                }
+                for (;;){
+                    // Endpoint r: an even r is the source of edge r / 2, an odd r its target.
+                    int64_t r = (int64_t)(random.Next() % (uint64_t)(2 * first));
+                    int source = (int)(r / 2 / m) + 1;
+                    int u = (r & 1) ? target[r / 2] : source;
+                    int k = 0;
+
+                    if (target[r / 2] == source){
+                        continue;   // A spare slot of the clique, not an edge
+                    }
+                    while ((k < j) && (target[first + k] != u)){
+                        k++;
+                    }
+                    if (k == j){
+                        target[first + j] = u;
+                        break;
+                    }
+                }
             }
-            // Else check other Rules
-            else {
-                return false;
+        }
+        return FromGenerator(n, (int64_t)target.size(), [&target, m](int64_t e, int& a, int& b){
+            a = (int)(e / m) + 1;
+            b = target[e];
+        }, threads);
+    }
+
+    /* Erased configuration model with a power law degree sequence:
+       degrees are drawn from P(d) ~ d^-gamma on [minDegree, maxDegree], the stubs are put in
+       random order by sorting on hashed keys (bucketed, then each bucket sorted in parallel)
+       and consecutive stubs are joined. Self loops and multi-edges are dropped. */
+
+    static Graph* Configuration(int n, double gamma, int minDegree, int maxDegree, uint64_t seed, int threads = 1){
+        vector<int64_t> stubStart(n + 1, 0);
+
+        ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+            for (int64_t i = begin; i < end; i++){
+                double u = (MixSeed(seed, i, 4) >> 11) * (1.0 / 9007199254740992.0);
+                double d = minDegree * pow(1.0 - u, -1.0 / (gamma - 1.0));
+
+                stubStart[i + 1] = (int64_t)min((double)maxDegree, floor(d));
             }
+        });
+        for (int i = 0; i < n; i++){
+            stubStart[i + 1] += stubStart[i];
         }
-        // Else if the node has only a right neighbor
-        else if (node->left == NULL){
-            // Update the node due to (3)
-            if (node->primary != node->right->primary){
-                node->Update();
-                return true;
+
+        int64_t stubs = stubStart[n];
+        vector< pair<uint64_t, int> > order(stubs);
+        vector< pair<uint64_t, int> > keyed(stubs);
+        int buckets = 256 * max(1, threads);
+        vector< vector<int64_t> > count(threads, vector<int64_t>(buckets + 1, 0));
+
+        ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+            for (int64_t i = begin; i < end; i++){
+                for (int64_t k = stubStart[i]; k < stubStart[i + 1]; k++){
+                    keyed[k] = make_pair(MixSeed(seed, k, 5), (int)i);
+                }
             }
-            // Else if the right node has the same state as the ith, do nothing.
-            else if (node->primary == node->right->primary){
-                return true;
+        });
+
+        // Scatter into buckets by the top bits of the key, keeping each thread's range in order.
+        ParallelFor(threads, stubs, [&](int t, int64_t begin, int64_t end){
+            for (int64_t k = begin; k < end; k++){
+                count[t][(keyed[k].first >> 40) * buckets >> 24]++;
             }
-            else {
-                return false;
+        });
+        vector<int64_t> bucketStart(buckets + 1, 0);
+        int64_t position = 0;
+        for (int bucket = 0; bucket < buckets; bucket++){
+            bucketStart[bucket] = position;
+            for (int t = 0; t < threads; t++){
+                int64_t size = count[t][bucket];
+
+                count[t][bucket] = position;
+                position += size;
             }
         }
-        // Else if the node has only a left neighbor
-        else if (node->right == NULL){
-            // Update the node due to (3)
-            if (node->primary != node->left->primary){
-                node->Update();
-                return true;
-            }
-            // Else if the left node has the same state as the ith, do nothing.
-            else if (node->primary == node->left->primary){
-                return true;
+        bucketStart[buckets] = position;
+        ParallelFor(threads, stubs, [&](int t, int64_t begin, int64_t end){
+            for (int64_t k = begin; k < end; k++){
+                order[count[t][(keyed[k].first >> 40) * buckets >> 24]++] = keyed[k];
             }
-            // Else check other Rules
-            else {
-                return false;
+        });
+        ParallelFor(threads, buckets, [&](int, int64_t begin, int64_t end){
+            for (int64_t bucket = begin; bucket < end; bucket++){
+                sort(order.begin() + bucketStart[bucket], order.begin() + bucketStart[bucket + 1]);
             }
-        }
+        });
+
+        return FromGenerator(n, stubs / 2, [&order](int64_t e, int& a, int& b){
+            a = order[2 * e].second;
+            b = order[2 * e + 1].second;
+        }, threads);
     }
 
-    /* Checks conditions when there exists some neighbor of the ith node 
-       which has a different state than the ith node, but not all neighbors
-       have a different state.
-       Checks if the node satisfies Rules 2a or 2b. */
+    int Size() const {
+        return nodes;
+    }
 
-    void CheckConditions(){
-        // If 2a is true
-        if (isLeader()){
-            node->Update();
-            node->secondary += (Max() + M);
+    int64_t Arcs() const {
+        return arcs;
+    }
+
+    int Degree(int i) const {
+        return (int)(offset[i + 1] - offset[i]);
+    }
+
+    const int* Begin(int i) const {
+        return adjacency + offset[i];
+    }
+
+    const int* End(int i) const {
+        return adjacency + offset[i + 1];
+    }
+
+    const int64_t* Offsets() const {
+        return offset;
+    }
+
+    const int* Adjacency() const {
+        return adjacency;
+    }
+
+    bool Mapped() const {
+        return mapping != NULL;
+    }
+
+    /* Attaches a named per-node (or other) int array, e.g. "part" or "color". */
+
+    void SetSection(const string& name, const vector<int>& data){
+        vector<int>& owned = ownedSections[name];
+
+        owned = data;
+        sections[name] = make_pair(owned.empty() ? (const int*)NULL : &owned[0], (int64_t)owned.size());
+    }
+
+    /* Returns the named section, or NULL when absent. */
+
+    const int* Section(const string& name, int64_t* length = NULL) const {
+        map<string, pair<const int*, int64_t> >::const_iterator it = sections.find(name);
+
+        if (it == sections.end()){
+            return NULL;
         }
-        // If 2b is true
-        else {
-            //node->Update();
-            node->secondary++;
+        if (length != NULL){
+            *length = it->second.second;
         }
+        return it->second.first;
     }
 
-    /* Checks if the current node is the local leader. */
+    vector<string> SectionNames() const {
+        vector<string> names;
 
-    bool isLeader(){
-        if (node->left == NULL){
-            if (node->secondary < node->right->secondary){
-                return false;
-            }
-            else {
-                return true;
-            }
+        for (map<string, pair<const int*, int64_t> >::const_iterator it = sections.begin(); it != sections.end(); ++it){
+            names.push_back(it->first);
         }
-        else if (node->right == NULL){
-            if (node->secondary < node->left->secondary){
-                return false;
+        return names;
+    }
+
+    friend class TopologyCache;
+};
+
+/* Per-node activity counters accumulated across trials.
+   Counters start sparse, in an open addressing table holding only the nodes that were
+   touched, and switch to a dense array once more than an eighth of the nodes are active.
+   Each worker thread owns one Heatmap; they are merged when the batch ends. */
+
+class Heatmap {
+public:
+    enum Kind { SELECTED, FLIPPED, RULE_2A, RULE_2B, KINDS };
+
+    /* Written to results files as is, so node is 64 bits wide and leaves no padding. */
+
+    struct Entry {
+        int64_t node;
+        uint64_t count[KINDS];
+    };
+
+private:
+    int nodes;
+    vector<uint64_t> dense;     // nodes * KINDS counters, empty while sparse
+    vector<Entry> entries;      // Active nodes while sparse
+    vector<int> table;          // Open addressing: entry index + 1, 0 when empty
+    size_t mask;
+
+    static size_t Hash(int node){
+        return (uint32_t)node * 2654435761u;
+    }
+
+    void Rehash(size_t capacity){
+        table.assign(capacity, 0);
+        mask = capacity - 1;
+        for (size_t e = 0; e < entries.size(); e++){
+            size_t h = Hash(entries[e].node) & mask;
+
+            while (table[h] != 0){
+                h = (h + 1) & mask;
             }
-            else {
-                return true;
+            table[h] = e + 1;
+        }
+    }
+
+    Entry& Find(int node){
+        size_t h = Hash(node) & mask;
+
+        while (table[h] != 0){
+            if (entries[table[h] - 1].node == node){
+                return entries[table[h] - 1];
             }
+            h = (h + 1) & mask;
         }
-        else if ((node->secondary < node->left->secondary) ||
-                 (node->secondary < node->right->secondary)){
-            return false;
+
+        Entry entry;
+        entry.node = node;
+        memset(entry.count, 0, sizeof(entry.count));
+        entries.push_back(entry);
+        table[h] = entries.size();
+        if (entries.size() * 2 > table.size()){
+            Rehash(table.size() * 2);
         }
-        return true;
+        return entries.back();
     }
 
-    /* Returns the greater secondary value between the neighbor nodes */
+    void Densify(){
+        dense.assign((size_t)nodes * KINDS, 0);
+        for (size_t e = 0; e < entries.size(); e++){
+            for (int k = 0; k < KINDS; k++){
+                dense[(size_t)entries[e].node * KINDS + k] += entries[e].count[k];
+            }
+        }
+        entries.clear();
+        table.clear();
+    }
 
-    int Max(){
-        if (node->left == NULL){
-            return node->right->secondary;
+public:
+    Heatmap(int _nodes) : nodes(_nodes){
+        Rehash(64);
+    }
+
+    void Add(int node, Kind kind){
+        if (!dense.empty()){
+            dense[(size_t)node * KINDS + kind]++;
+        }
+        else {
+            Find(node).count[kind]++;
+            if (entries.size() > (size_t)nodes / 8){
+                Densify();
+            }
         }
-        else if (node->right == NULL){
-            return node->left->secondary;
+    }
+
+    bool Dense() const {
+        return !dense.empty();
+    }
+
+    /* Adds the counters of other, which must cover the same nodes. */
+
+    void Merge(const Heatmap& other){
+        vector<Entry> active = other.Active();
+
+        for (size_t e = 0; e < active.size(); e++){
+            for (int k = 0; k < KINDS; k++){
+                if (!dense.empty()){
+                    dense[(size_t)active[e].node * KINDS + k] += active[e].count[k];
+                }
+                else {
+                    Find(active[e].node).count[k] += active[e].count[k];
+                }
+            }
+            if (dense.empty() && (entries.size() > (size_t)nodes / 8)){
+                Densify();
+            }
         }
-        else if (node->right->secondary > node->left->secondary){
-            return node->right->secondary;
+    }
+
+    /* Nodes with any nonzero counter, in ascending node order. */
+
+    vector<Entry> Active() const {
+        vector<Entry> active;
+
+        if (!dense.empty()){
+            for (int i = 0; i < nodes; i++){
+                const uint64_t* count = &dense[(size_t)i * KINDS];
+
+                if (count[0] | count[1] | count[2] | count[3]){
+                    Entry entry;
+                    entry.node = i;
+                    memcpy(entry.count, count, sizeof(entry.count));
+                    active.push_back(entry);
+                }
+            }
         }
         else {
-            return node->left->secondary;
+            active = entries;
+            sort(active.begin(), active.end(), [](const Entry& a, const Entry& b){ return a.node < b.node; });
         }
+        return active;
     }
+};
 
-    /* Calls the Print() function of each node in the system starting from the current node. */
+/* A sampled step: the state of the selected node and its neighborhood before the step,
+   and the rule the step applies. */
 
-    void Print(){
-        node = &member[0];
+struct TraceRecord {
+    enum Rule { NONE, RULE_3, RULE_2A, RULE_2B };
+    enum { NEIGHBORS = 4 };
+
+    int64_t step;               // Step within the trial, from 1
+    int64_t disagree;           // Disagreeing edges before the step
+    int32_t trial;
+    int32_t node;
+    int32_t rule;
+    int32_t primary;
+    int32_t secondary;
+    int32_t neighborMax;
+    int32_t unequal;
+    int32_t degree;
+    int32_t neighbor[NEIGHBORS];        // The first neighbors, -1 past the degree
+    int32_t neighborPrimary[NEIGHBORS];
+    int32_t neighborSecondary[NEIGHBORS];
+};
+
+/* Sampling step tracer, one per thread.
+   Samples are 1 in every steps on average, or one per every microseconds, with gaps drawn
+   uniformly from [1, 2 every - 1] so that periodic behaviour does not alias with the
+   sampling. The System only counts down to the next sample, so a step costs a decrement
+   when not sampled. Buffers hold at most capacity records; past that, reservoir sampling
+   keeps a uniform sample of everything traced. */
 
-        while (node != NULL){
-            node->Print();
-            node = node->right;
+class StepTracer {
+private:
+    vector<TraceRecord> records;
+    size_t capacity;
+    int64_t seen;               // Samples taken, kept or not
+    long every;
+    bool timed;                 // every is in microseconds
+    Random random;
+    chrono::steady_clock::time_point last;
+    long gap;                   // Steps of the current gap
+
+public:
+    int trial;                  // Set by the driver before each trial
+
+    StepTracer(long _every, bool _timed, size_t _capacity, uint64_t seed)
+        : capacity(max((size_t)1, _capacity)), seen(0), every(max(1L, _every)), timed(_timed), random(seed),
+          last(chrono::steady_clock::now()), gap(1), trial(0){}
+
+    /* Steps until the next sample. Timed tracers rescale the gap by the step rate measured
+       over the last gap. */
+
+    long Next(){
+        long mean = every;
+
+        if (timed){
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            double elapsed = chrono::duration<double, micro>(now - last).count();
+
+            mean = max(1L, (long)(every * gap / max(elapsed, 1e-3)));
+            last = now;
         }
+        gap = 1 + (long)(random.Next() % (uint64_t)(2 * mean - 1));
+        return gap;
+    }
 
-        cout << '\n';
-        node = &member[0];
+    /* Slot for a new sample, or NULL when the reservoir drops it. */
+
+    TraceRecord* Claim(){
+        seen++;
+        if (records.size() < capacity){
+            records.push_back(TraceRecord());
+            return &records.back();
+        }
+        uint64_t k = random.Next() % (uint64_t)seen;
+        return (k < capacity) ? &records[k] : NULL;
     }
-};
 
-void print();
+    int64_t Seen() const {
+        return seen;
+    }
 
-int main()
-{
+    const vector<TraceRecord>& Records() const {
+        return records;
+    }
+};
+
+/* Predicates watched during stabilization, one set per thread.
+   Each predicate is checked where the quantity it reads changes, from the delta of that
+   change, never by rescanning:
+       DISAGREEMENT  disagreeing edges > limit, checked when a node flips
+       SECONDARY     a secondary > limit, checked when a secondary is set
+       RADIUS        a node farther than limit hops from every fault flips; the ball of
+                     radius limit around each fault is marked by a bounded search when the
+                     fault is injected, so a flip costs one lookup
+   A watch fires at most once per trial. Its action is to snapshot every node's primary and
+   secondary, to dump the trial's traced steps so far (with a StepTracer attached), or to
+   abort the trial after the current step. */
+
+class Watchpoints {
+public:
+    enum Predicate { DISAGREEMENT, SECONDARY, RADIUS };
+    enum Action { SNAPSHOT, DUMP, ABORT };
+
+    struct Watch {
+        Predicate predicate;
+        int64_t limit;
+        Action action;
+    };
+
+    struct Event {
+        int watch;                  // Index into the watches
+        int trial;
+        long step;
+        int node;                   // Node whose change fired the watch
+        int64_t value;              // Disagreement, secondary or distance to the nearest fault
+        vector< pair<int, int> > snapshot;  // Primary and secondary of every node
+        vector<TraceRecord> trace;
+    };
+
+    vector<Watch> watches;
+    vector<Event> events;
+    size_t capacity;                // Events kept, later ones are only counted
+    int64_t fired;                  // Events including those not kept
+    int64_t aborted;                // Trials stopped by an ABORT watch
+    int trial;                      // Set by the driver before each trial
+
+private:
+    vector<bool> armed;
+    vector<int> distance;           // Hops to the nearest fault within the radius, -1 beyond
+    vector<int> marked;             // Nodes with a distance, to clear on Reset
+    vector<int> faults;
+    int radius;                     // Greatest RADIUS limit, -1 without one
+
+public:
+    Watchpoints(const vector<Watch>& _watches, size_t _capacity)
+        : watches(_watches), capacity(_capacity), fired(0), aborted(0), trial(0), armed(_watches.size(), true), radius(-1){
+        for (size_t w = 0; w < watches.size(); w++){
+            if (watches[w].predicate == RADIUS){
+                radius = max(radius, (int)watches[w].limit);
+            }
+        }
+    }
+
+    /* Parses "disagreement>100:abort,secondary>1000000:snapshot,radius>4:dump".
+       Returns false on a malformed watch. */
+
+    static bool Parse(const string& text, vector<Watch>& watches){
+        const char* predicates[3] = { "disagreement", "secondary", "radius" };
+        const char* actions[3] = { "snapshot", "dump", "abort" };
+        stringstream in(text);
+        string item;
+
+        while (getline(in, item, ',')){
+            size_t gt = item.find('>'), colon = item.find(':');
+            Watch watch = { DISAGREEMENT, 0, SNAPSHOT };
+            int found = 0;
+
+            if ((gt == string::npos) || (colon == string::npos) || (colon < gt)){
+                return false;
+            }
+            for (int k = 0; k < 3; k++){
+                if (item.substr(0, gt) == predicates[k]){
+                    watch.predicate = (Predicate)k;
+                    found++;
+                }
+                if (item.substr(colon + 1) == actions[k]){
+                    watch.action = (Action)k;
+                    found++;
+                }
+            }
+            watch.limit = atol(item.substr(gt + 1, colon - gt - 1).c_str());
+            if ((found != 2) || (watch.limit < 0)){
+                return false;
+            }
+            watches.push_back(watch);
+        }
+        return true;
+    }
+
+    /* Rearms every watch and forgets the faults of the previous trial. */
+
+    void Reset(int nodes){
+        armed.assign(watches.size(), true);
+        if (radius >= 0){
+            distance.resize(nodes, -1);
+            for (size_t k = 0; k < marked.size(); k++){
+                distance[marked[k]] = -1;
+            }
+            marked.clear();
+            faults.clear();
+        }
+    }
+
+    /* Marks the ball of the RADIUS limit around a new fault at node i. */
+
+    void Fault(const Graph& graph, int i){
+        if (radius < 0){
+            return;
+        }
+        faults.push_back(i);
+        if (distance[i] != 0){
+            if (distance[i] < 0){
+                marked.push_back(i);
+            }
+            distance[i] = 0;
+        }
+        // Bounded breadth first search that only improves distances.
+        vector<int> queue(1, i);
+        for (size_t head = 0; head < queue.size(); head++){
+            int v = queue[head];
+
+            if (distance[v] == radius){
+                continue;
+            }
+            for (const int* j = graph.Begin(v); j != graph.End(v); j++){
+                if ((distance[*j] < 0) || (distance[*j] > distance[v] + 1)){
+                    if (distance[*j] < 0){
+                        marked.push_back(*j);
+                    }
+                    distance[*j] = distance[v] + 1;
+                    queue.push_back(*j);
+                }
+            }
+        }
+    }
+
+    /* Hop distance from node i to the nearest fault, by a search from the faults; only
+       used once a RADIUS watch fires. */
+
+    int FaultDistance(const Graph& graph, int i) const {
+        vector<int> hops(graph.Size(), -1);
+        vector<int> queue(faults);
+
+        for (size_t k = 0; k < queue.size(); k++){
+            hops[queue[k]] = 0;
+        }
+        for (size_t head = 0; head < queue.size(); head++){
+            int v = queue[head];
+
+            if (v == i){
+                return hops[v];
+            }
+            for (const int* j = graph.Begin(v); j != graph.End(v); j++){
+                if (hops[*j] < 0){
+                    hops[*j] = hops[v] + 1;
+                    queue.push_back(*j);
+                }
+            }
+        }
+        return -1;
+    }
+
+    /* Index of the armed watch of the predicate that value exceeds, disarming it, or -1. */
+
+    int Check(Predicate predicate, int64_t value){
+        for (size_t w = 0; w < watches.size(); w++){
+            if (armed[w] && (watches[w].predicate == predicate) && (value > watches[w].limit)){
+                armed[w] = false;
+                return w;
+            }
+        }
+        return -1;
+    }
+
+    /* RADIUS check of a flip at node i, whose distance is only known up to the greatest limit. */
+
+    int CheckFlip(int i){
+        return (radius >= 0) ? Check(RADIUS, (distance[i] < 0) ? radius + 1 : distance[i]) : -1;
+    }
+
+    /* Slot for an event, or NULL once capacity events are kept. */
+
+    Event* Record(){
+        fired++;
+        if (events.size() >= capacity){
+            return NULL;
+        }
+        events.push_back(Event());
+        return &events.back();
+    }
+};
+
+/* Progress of a System, published for other threads at safe points, and the requests
+   they make of it. A System reaches a safe point every interval steps through the countdown
+   it already keeps for tracing, so a step between safe points costs nothing extra and a
+   reader sees values at most interval steps old. At a safe point the System stops if the
+   cancellation token is set, and answers a dump request (see RequestDump()) by writing a
+   statistics line to cerr and, with a dump prefix, its configuration to <prefix>-<id>. */
+
+class Progress {
+public:
+    atomic<long> steps;             // Steps taken by the current Stabilize
+    atomic<int64_t> disagree;       // Disagreeing edges
+    atomic<int> enabled;            // Nodes with a disagreeing neighbor, the ones a rule applies to
+    atomic<int64_t> trials;         // Trials finished, counted by the driver
+    atomic<int> trial;              // Trial in progress, set by the driver
+    const atomic<bool>* cancel;     // Token to stop at, NULL for none
+    long interval;                  // Steps between safe points
+    int id;                         // Names the dump file
+    string dumpPrefix;              // Configuration dump file prefix, empty for none
+
+private:
+    int answered;                   // Dump requests answered
+    static atomic<int> requests;    // Dump requests made, constant initialized for the signal handler
+
+public:
+    Progress(long _interval = 65536, int _id = 0)
+        : steps(0), disagree(0), enabled(0), trials(0), trial(0), cancel(NULL), interval(max(1L, _interval)),
+          id(_id), answered(requests){}
+
+    /* Asks every Progress for a dump at its next safe point; async signal safe. */
+
+    static void RequestDump(){
+        requests++;
+    }
+
+    /* SIGUSR1 handler that requests a dump. Installs nothing by itself, see signal(). */
+
+    static void OnSignal(int){
+        RequestDump();
+    }
+
+    /* True once, at a safe point, for each dump requested since the last. */
+
+    bool DumpDue(){
+        int made = requests;
+
+        if (made == answered){
+            return false;
+        }
+        answered = made;
+        return true;
+    }
+
+    bool Cancelled() const {
+        return (cancel != NULL) && cancel->load(memory_order_relaxed);
+    }
+};
+
+atomic<int> Progress::requests(0);
+
+/* Recorded scheduler: the order in which a deployment ran its nodes' stabilization steps,
+   replayed in place of the random scheduler. The log is mapped read only and shared; each
+   System reads it through its own Cursor, which tells the kernel to drop the pages behind it,
+   so logs larger than memory stream from disk.
+   Binary logs are the magic "STABACT1" followed by node ids as little endian uint32. Any other
+   file is text: decimal node ids separated by whitespace or commas, '#' starting a comment
+   that runs to the end of the line. */
+
+class ActivationLog {
+private:
+    void* mapping;
+    size_t size;
+    const char* base;
+    size_t first;               // Offset of the first activation
+    bool binary;
+    int64_t count;              // Activations
+    size_t page;
+
+    static const size_t RELEASE = (size_t)64 << 20;    // Bytes read between page releases
+
+    ActivationLog() : mapping(NULL), size(0), base(NULL), first(0), binary(false), count(0), page(sysconf(_SC_PAGESIZE)){}
+    ActivationLog(const ActivationLog&);
+    ActivationLog& operator=(const ActivationLog&);
+
+    /* Drops the whole pages in [released, position) from this process. */
+
+    void Release(size_t& released, size_t position) const {
+        size_t end = position / page * page;
+
+        if (end > released){
+            madvise((char*)base + released, end - released, MADV_DONTNEED);
+            released = end;
+        }
+    }
+
+    /* Checks that every activation names one of nodes, counting them. Returns "" or an error. */
+
+    string Validate(int nodes){
+        size_t released = 0;
+
+        count = 0;
+        if (binary){
+            if ((size - first) % sizeof(uint32_t) != 0){
+                return "binary log is not a whole number of uint32 ids";
+            }
+            for (size_t at = first; at < size; at += sizeof(uint32_t)){
+                uint32_t id;
+
+                memcpy(&id, base + at, sizeof(id));
+                if (id >= (uint32_t)nodes){
+                    return "activation " + to_string(count) + " names node " + to_string(id) + " of " + to_string(nodes);
+                }
+                count++;
+                if (at - released >= RELEASE){
+                    Release(released, at);
+                }
+            }
+            return "";
+        }
+        for (size_t at = first; at < size; ){
+            char c = base[at];
+
+            if (c == '#'){
+                while ((at < size) && (base[at] != '\n')){
+                    at++;
+                }
+            }
+            else if (isspace((unsigned char)c) || (c == ',')){
+                at++;
+            }
+            else if (isdigit((unsigned char)c)){
+                int64_t id = 0;
+
+                while ((at < size) && isdigit((unsigned char)base[at]) && (id < nodes)){
+                    id = 10 * id + (base[at++] - '0');
+                }
+                if (id >= nodes){
+                    return "activation " + to_string(count) + " names a node past " + to_string(nodes - 1);
+                }
+                count++;
+            }
+            else {
+                return "unexpected '" + string(1, c) + "' after activation " + to_string(count);
+            }
+            if (at - released >= RELEASE){
+                Release(released, at);
+            }
+        }
+        return "";
+    }
+
+public:
+    ~ActivationLog(){
+        if (mapping != NULL){
+            munmap(mapping, size);
+        }
+    }
+
+    /* Maps and validates the log at path for a topology of nodes. Returns NULL and sets error
+       when the file cannot be mapped or names a node outside the topology. */
+
+    static ActivationLog* Open(const string& path, int nodes, string& error){
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+
+        if ((fd < 0) || (fstat(fd, &info) != 0)){
+            error = "cannot open " + path;
+            if (fd >= 0){
+                close(fd);
+            }
+            return NULL;
+        }
+
+        ActivationLog* log = new ActivationLog();
+        log->size = info.st_size;
+        if (log->size > 0){
+            log->mapping = mmap(NULL, log->size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (log->mapping == MAP_FAILED){
+            log->mapping = NULL;
+            error = "cannot map " + path;
+            delete log;
+            return NULL;
+        }
+        log->base = (const char*)log->mapping;
+        log->binary = (log->size >= 8) && (memcmp(log->base, "STABACT1", 8) == 0);
+        log->first = log->binary ? 8 : 0;
+        if (log->mapping != NULL){
+            madvise(log->mapping, log->size, MADV_SEQUENTIAL);
+        }
+        if (!(error = log->Validate(nodes)).empty() || (log->count == 0)){
+            error = path + ": " + (error.empty() ? "no activations" : error);
+            delete log;
+            return NULL;
+        }
+        return log;
+    }
+
+    bool Binary() const {
+        return binary;
+    }
+
+    int64_t Count() const {
+        return count;
+    }
+
+    /* One replay of the log, from its start. */
+
+    class Cursor {
+    private:
+        const ActivationLog& log;
+        size_t position;
+        size_t released;        // Pages before this offset were dropped
+
+    public:
+        Cursor(const ActivationLog& _log) : log(_log), position(_log.first), released(0){}
+
+        void Rewind(){
+            position = log.first;
+            released = 0;
+        }
+
+        /* The next activated node, or -1 at the end of the log. */
+
+        int Next(){
+            int id = 0;
+
+            if (log.binary){
+                uint32_t value;
+
+                if (position >= log.size){
+                    return -1;
+                }
+                memcpy(&value, log.base + position, sizeof(value));
+                position += sizeof(value);
+                id = value;
+            }
+            else {
+                while ((position < log.size) && !isdigit((unsigned char)log.base[position])){
+                    if (log.base[position] == '#'){
+                        while ((position < log.size) && (log.base[position] != '\n')){
+                            position++;
+                        }
+                    }
+                    else {
+                        position++;
+                    }
+                }
+                if (position >= log.size){
+                    return -1;
+                }
+                while ((position < log.size) && isdigit((unsigned char)log.base[position])){
+                    id = 10 * id + (log.base[position++] - '0');
+                }
+            }
+            if (position - released >= RELEASE){
+                log.Release(released, position);
+            }
+            return id;
+        }
+    };
+};
+
+/* Schedulers with guarantees the random one lacks, one per System. Both select in rounds
+   from rotating buckets, so a selection costs O(1) amortized:
+       FAIR     k-bounded fair. Each round selects every node between 1 and k / 2 times in a
+                fresh random order, so between two selections of a node no other node is
+                selected more than k times. With k = 1 every round repeats one random order,
+                so each other node is selected exactly once in between.
+       CENTRAL  locally central. Each round is a color class of a proper coloring, the classes
+                taken in a random order per sweep and each class in random order. No two nodes
+                of a class are neighbors, so selecting them one after another is the same as
+                moving them at once: a round is one step of a locally central daemon.
+   As with the random scheduler, selecting a node no rule applies to is a step without a move.
+   Rounds() counts the rounds in which some node moved. */
+
+class Scheduler {
+public:
+    enum Kind { RANDOM, FAIR, CENTRAL };
+
+private:
+    Kind kind;
+    int k;
+    int nodes;
+    vector<int> bucket;         // Selections of the current round
+    size_t next;                // Next selection in bucket
+    vector<int> order;          // CENTRAL: nodes grouped by color; FAIR with k = 1: the repeated order
+    vector<int> start;          // CENTRAL: first position of each color in order, then the end
+    vector<int> sweep;          // CENTRAL: colors left in the current sweep
+    bool drawn;                 // FAIR with k = 1: order was shuffled for this trial
+    bool moved;                 // Some node moved in the current round
+    int64_t rounds;             // Rounds with a move before the current one
+
+    static void Shuffle(vector<int>::iterator begin, vector<int>::iterator end, Random& random){
+        for (int i = (int)(end - begin) - 1; i > 0; i--){
+            swap(begin[i], begin[random.Below(i + 1)]);
+        }
+    }
+
+    /* Starts the next round. */
+
+    void Fill(Random& random){
+        if (kind == FAIR){
+            if (k == 1){
+                if (!drawn){
+                    Shuffle(order.begin(), order.end(), random);
+                    drawn = true;
+                }
+                bucket = order;
+            }
+            else {
+                bucket.clear();
+                for (int v = 0; v < nodes; v++){
+                    for (int times = (k >= 4) ? 1 + random.Below(k / 2) : 1; times > 0; times--){
+                        bucket.push_back(v);
+                    }
+                }
+                Shuffle(bucket.begin(), bucket.end(), random);
+            }
+        }
+        else {
+            if (sweep.empty()){
+                for (int c = 0; c + 1 < (int)start.size(); c++){
+                    sweep.push_back(c);
+                }
+                Shuffle(sweep.begin(), sweep.end(), random);
+            }
+            int c = sweep.back();
+
+            sweep.pop_back();
+            bucket.assign(order.begin() + start[c], order.begin() + start[c + 1]);
+            Shuffle(bucket.begin(), bucket.end(), random);
+        }
+        rounds += moved;
+        moved = false;
+        next = 0;
+    }
+
+public:
+    /* FAIR takes k >= 1; CENTRAL takes the color of every node of graph, see Coloring(). */
+
+    Scheduler(const Graph& graph, Kind _kind, int _k, const int* color)
+        : kind(_kind), k(max(1, _k)), nodes(graph.Size()), next(0), drawn(false), moved(false), rounds(0){
+        if (kind == CENTRAL){
+            int colors = 0;
+
+            for (int v = 0; v < nodes; v++){
+                colors = max(colors, color[v] + 1);
+            }
+            start.assign(colors + 1, 0);
+            for (int v = 0; v < nodes; v++){
+                start[color[v] + 1]++;
+            }
+            for (int c = 0; c < colors; c++){
+                start[c + 1] += start[c];
+            }
+            order.resize(nodes);
+            vector<int> position(start.begin(), start.end() - 1);
+            for (int v = 0; v < nodes; v++){
+                order[position[color[v]]++] = v;
+            }
+        }
+        else if (k == 1){
+            for (int v = 0; v < nodes; v++){
+                order.push_back(v);
+            }
+        }
+    }
+
+    /* Greedy proper coloring, highest degree first (Welsh-Powell), so at most max degree + 1
+       colors and usually far fewer. */
+
+    static vector<int> Coloring(const Graph& graph){
+        int n = graph.Size();
+        vector<int> color(n, -1), byDegree(n), used;
+
+        for (int v = 0; v < n; v++){
+            byDegree[v] = v;
+        }
+        stable_sort(byDegree.begin(), byDegree.end(), [&graph](int a, int b){
+            return graph.Degree(a) > graph.Degree(b);
+        });
+        for (int i = 0; i < n; i++){
+            int v = byDegree[i], c = 0;
+
+            // used[c] == i + 1 marks color c as taken by a neighbor of v
+            for (const int* j = graph.Begin(v); j != graph.End(v); j++){
+                if (color[*j] >= 0){
+                    if (color[*j] >= (int)used.size()){
+                        used.resize(color[*j] + 1, 0);
+                    }
+                    used[color[*j]] = i + 1;
+                }
+            }
+            while ((c < (int)used.size()) && (used[c] == i + 1)){
+                c++;
+            }
+            color[v] = c;
+        }
+        return color;
+    }
+
+    /* Whether color, e.g. a section read from a cache file, is a proper coloring of graph:
+       every color in [0, nodes) and no edge joining two nodes of the same color. */
+
+    static bool ProperColoring(const Graph& graph, const int* color){
+        for (int v = 0; v < graph.Size(); v++){
+            if ((color[v] < 0) || (color[v] >= graph.Size())){
+                return false;
+            }
+            for (const int* j = graph.Begin(v); j != graph.End(v); j++){
+                if ((*j != v) && (color[*j] == color[v])){
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    int Colors() const {
+        return max(0, (int)start.size() - 1);
+    }
+
+    /* Forgets the current round; the next selection starts a trial. */
+
+    void Reset(){
+        bucket.clear();
+        sweep.clear();
+        next = 0;
+        drawn = false;
+        moved = false;
+        rounds = 0;
+    }
+
+    int Next(Random& random){
+        while (next == bucket.size()){
+            Fill(random);
+        }
+        return bucket[next++];
+    }
+
+    /* Tells whether a rule applied to the node last selected. */
+
+    void Moved(bool enabled){
+        moved |= enabled;
+    }
+
+    int64_t Rounds() const {
+        return rounds + moved;
+    }
+};
+
+/* Fault causality totals over a batch of trials, see System::EnableCausality(). */
+
+struct CausalityStats {
+    int64_t faults;         // Labelled faults
+    int64_t reached;        // Sum over faults of the distinct nodes that fired on its behalf
+    int64_t radius;         // Sum over faults of the containment radius
+    int64_t maxRadius;      // Largest containment radius of any fault
+    int64_t firings;        // Rule firings carrying at least one label
+    int64_t interacting;    // Firings attributed to two or more faults
+
+    CausalityStats() : faults(0), reached(0), radius(0), maxRadius(0), firings(0), interacting(0){}
+
+    void Merge(const CausalityStats& other){
+        faults += other.faults;
+        reached += other.reached;
+        radius += other.radius;
+        maxRadius = max(maxRadius, other.maxRadius);
+        firings += other.firings;
+        interacting += other.interacting;
+    }
+};
+
+/* Node class.
+   Contains primary and secondary variables for stabilization logic.
+   Nodes are connected by the System's topology; each node caches what it needs from
+   its neighborhood so the rules can be checked without visiting the neighbors. */
+
+class Node {
+private:
+    int primary;      // Primary attribute
+    int secondary;    // Secondary attribute
+    int unequal;      // Number of neighbors whose primary differs from this node's
+    int neighborMax;  // Greatest secondary among the neighbors
+
+public:
+    /* Default constructor. */
+
+    Node(){
+        primary = 0;
+        secondary = 5;  // Arbitrary value
+        unequal = 0;
+        neighborMax = secondary;
+    }
+
+    /* Compares the primary variables of two nodes.
+       Returns true when the two primary values are equal. */
+
+    bool Equal(const Node other){
+        if (primary == other.primary){
+            return true;
+        }
+        return false;
+    }
+
+    /* Updates the primary value of the node.
+       In our system this will simply flip the value. */
+
+    void Update(){
+        if (primary == 0){
+            primary = 1;
+        }
+        else {
+            primary = 0;
+        }
+    }
+
+    /* Prints primary variable to standard output. */
+
+    void Print(){
+        cout << primary << ' ';
+    }
+
+    friend class System;
+};
+
+class System {
+private:
+    int SYSTEM_SIZE;	// Number of Nodes in system
+    Node* member;    	// Array of Nodes
+    Node* node;         // Pointer to the current node
+    const Graph* graph; // Topology
+    bool ownsGraph;     // Whether graph was built by and is deleted with the System
+    int64_t disagree;   // Number of edges whose endpoints have unequal primaries
+    int enabled;        // Number of nodes with a disagreeing neighbor
+    Random random;      // Scheduler randomness
+    RuleConstants constants;    // M, 2b increment and initial secondary
+    Heatmap* heatmap;   // Per-node activity counters, NULL when not collected
+    StepTracer* tracer; // Sampled steps, NULL when not tracing
+    long countdown;     // Steps until the next sample, safe point or abort check
+    long armed;         // Steps countdown was last set to
+    long untilSample;   // Steps from the last arming to the next sample, LONG_MAX when not tracing
+    long untilCheck;    // Steps from the last arming to the next safe point, LONG_MAX without progress
+    Watchpoints* watch; // Watched predicates, NULL when none
+    Progress* progress; // Published progress and cancellation, NULL when none
+    ActivationLog::Cursor* schedule;    // Replayed activations, NULL for the random scheduler
+    Scheduler* scheduler;               // Fair or locally central scheduler, NULL for the random one
+    bool exhausted;     // The replayed log ended before the system stabilized
+    bool halted;        // A watchpoint aborted the trial
+    long watchStep;     // Steps taken in the current Stabilize, for watch events
+
+    // Fault causality, see EnableCausality(). Empty when disabled.
+    vector<uint64_t> label;     // Faults whose disagreement has reached each node
+    vector<uint64_t> fired;     // Faults each node has fired a rule on behalf of
+    vector<int> distance;       // BFS scratch of CollectCausality, -1 outside the current search
+    vector<int> queue;          // BFS order of CollectCausality
+    int faultCount;             // Faults injected since Reset
+    int origin[64];             // Node of each labelled fault
+    int64_t reach[64];          // Distinct nodes that fired on behalf of each fault
+    CausalityStats trial;       // Firing counts of the current trial
+
+    /* Flips the primary value of the ith node, keeping the unequal counts of the node and
+       its neighbors and the disagreement count exact.
+       With causality on, neighbors that now disagree with the node inherit its labels. */
+
+    void Flip(int i){
+        Node& target = member[i];
+        int degree = graph->Degree(i);
+        bool labelled = !label.empty();
+
+        for (const int* j = graph->Begin(i); j != graph->End(i); j++){
+            Node& neighbor = member[*j];
+
+            if (neighbor.primary == target.primary){
+                enabled += (neighbor.unequal++ == 0);
+                if (labelled){
+                    label[*j] |= label[i];
+                }
+            }
+            else {
+                enabled -= (--neighbor.unequal == 0);
+            }
+        }
+        disagree += degree - 2 * target.unequal;
+        enabled += (target.unequal < degree) - (target.unequal > 0);
+        target.unequal = degree - target.unequal;
+        target.Update();
+        if (watch != NULL){
+            Fire(watch->Check(Watchpoints::DISAGREEMENT, disagree), i, disagree);
+            Fire(watch->CheckFlip(i), i, -1);
+        }
+    }
+
+    /* Sets the secondary value of the ith node and pushes it into the neighborMax of each
+       neighbor. Secondaries only grow, so a push is a single comparison per neighbor; if a
+       value ever decreases (integer wrap around) the affected maxima are recomputed. */
+
+    void SetSecondary(int i, int value){
+        bool decreased = (value < member[i].secondary);
+
+        member[i].secondary = value;
+        if (watch != NULL){
+            Fire(watch->Check(Watchpoints::SECONDARY, value), i, value);
+        }
+        for (const int* j = graph->Begin(i); j != graph->End(i); j++){
+            Node& neighbor = member[*j];
+
+            if (decreased){
+                neighbor.neighborMax = NeighborMax(*j);
+            }
+            else if (value > neighbor.neighborMax){
+                neighbor.neighborMax = value;
+            }
+        }
+    }
+
+    /* Greatest secondary among the neighbors of the ith node, by scanning them. */
+
+    int NeighborMax(int i){
+        int max = member[i].secondary;
+
+        if (graph->Degree(i) > 0){
+            max = member[*graph->Begin(i)].secondary;
+        }
+        for (const int* j = graph->Begin(i); j != graph->End(i); j++){
+            if (member[*j].secondary > max){
+                max = member[*j].secondary;
+            }
+        }
+        return max;
+    }
+
+    /* Records a rule firing of the ith node on behalf of the faults in its label. */
+
+    void Fired(int i){
+        uint64_t bits = label[i];
+        uint64_t fresh = bits & ~fired[i];
+
+        if (bits == 0){
+            return;
+        }
+        fired[i] |= bits;
+        trial.firings++;
+        trial.interacting += ((bits & (bits - 1)) != 0);
+        while (fresh != 0){
+            reach[__builtin_ctzll(fresh)]++;
+            fresh &= fresh - 1;
+        }
+    }
+
+    /* Carries out the action of watch w (if not -1), fired by a change at node i. */
+
+    void Fire(int w, int i, int64_t value){
+        Watchpoints::Event* event;
+
+        if (w < 0){
+            return;
+        }
+        if (watch->watches[w].action == Watchpoints::ABORT){
+            halted = true;
+            countdown = 1;     // Stabilize stops at its next countdown check
+            watch->aborted++;
+        }
+        if ((event = watch->Record()) == NULL){
+            return;
+        }
+        event->watch = w;
+        event->trial = watch->trial;
+        event->step = watchStep;
+        event->node = i;
+        event->value = (value < 0) ? watch->FaultDistance(*graph, i) : value;
+        switch (watch->watches[w].action){
+            case Watchpoints::SNAPSHOT:
+                for (int k = 0; k < SYSTEM_SIZE; k++){
+                    event->snapshot.push_back(make_pair(member[k].primary, member[k].secondary));
+                }
+                break;
+            case Watchpoints::DUMP:
+                for (size_t r = 0; (tracer != NULL) && (r < tracer->Records().size()); r++){
+                    if (tracer->Records()[r].trial == watch->trial){
+                        event->trace.push_back(tracer->Records()[r]);
+                    }
+                }
+                break;
+            case Watchpoints::ABORT:
+                break;
+        }
+    }
+
+    /* Sets the countdown to the next sample or safe point, whichever comes first. */
+
+    void Rearm(){
+        countdown = armed = min(untilSample, untilCheck);
+    }
+
+    /* Restarts the sample and safe point gaps. */
+
+    void Restart(){
+        untilSample = (tracer != NULL) ? tracer->Next() : LONG_MAX;
+        untilCheck = (progress != NULL) ? progress->interval : LONG_MAX;
+        Rearm();
+    }
+
+    /* Slow path of a step, taken when the countdown expires: stops before the step when a
+       watchpoint aborted the trial or at a cancelled safe point, otherwise traces it if a
+       sample is due. */
+
+    bool Pause(long step){
+        if (halted){
+            return true;
+        }
+        untilSample -= armed;
+        untilCheck -= armed;
+        if (untilSample == 0){
+            untilSample = tracer->Next();
+            Trace(step);
+        }
+        if (untilCheck == 0){
+            untilCheck = progress->interval;
+            if (SafePoint(step)){
+                return true;
+            }
+        }
+        Rearm();
+        return false;
+    }
+
+    /* Publishes the progress of step and answers requests made of it.
+       Returns true, halting, when the run is cancelled. */
+
+    bool SafePoint(long step){
+        Publish(step);
+        if (progress->DumpDue()){
+            Dump(step);
+        }
+        if (progress->Cancelled()){
+            halted = true;
+            return true;
+        }
+        return false;
+    }
+
+    void Publish(long step){
+        progress->steps.store(step, memory_order_relaxed);
+        progress->disagree.store(disagree, memory_order_relaxed);
+        progress->enabled.store(enabled, memory_order_relaxed);
+    }
+
+    /* Writes a statistics line to cerr and, with a dump prefix, every node's primary and
+       secondary to <prefix>-<id>. */
+
+    void Dump(long step){
+        static mutex lock;
+        lock_guard<mutex> hold(lock);
+
+        cerr << "dump: worker " << progress->id << " trial " << progress->trial << " step " << step
+             << " disagree " << disagree << " enabled " << enabled << " trials done " << progress->trials << '\n';
+        if (!progress->dumpPrefix.empty()){
+            ofstream out(progress->dumpPrefix + "-" + to_string(progress->id));
+
+            for (int k = 0; k < SYSTEM_SIZE; k++){
+                out << k << ' ' << member[k].primary << ' ' << member[k].secondary << '\n';
+            }
+            if (!out){
+                cerr << "dump: cannot write " << progress->dumpPrefix << '-' << progress->id << '\n';
+            }
+        }
+    }
+
+    /* Records the selected node's neighborhood and the rule it is about to apply. */
+
+    void Trace(long step){
+        int i = node - member;
+        TraceRecord* record;
+
+        if ((record = tracer->Claim()) == NULL){
+            return;
+        }
+        record->step = step;
+        record->disagree = disagree;
+        record->trial = tracer->trial;
+        record->node = i;
+        record->primary = node->primary;
+        record->secondary = node->secondary;
+        record->neighborMax = node->neighborMax;
+        record->unequal = node->unequal;
+        record->degree = graph->Degree(i);
+        record->rule = (node->unequal == 0) ? TraceRecord::NONE :
+                       (node->unequal == record->degree) ? TraceRecord::RULE_3 :
+                       isLeader() ? TraceRecord::RULE_2A : TraceRecord::RULE_2B;
+        for (int k = 0; k < TraceRecord::NEIGHBORS; k++){
+            int j = (k < record->degree) ? graph->Begin(i)[k] : -1;
+
+            record->neighbor[k] = j;
+            record->neighborPrimary[k] = (j < 0) ? 0 : member[j].primary;
+            record->neighborSecondary[k] = (j < 0) ? 0 : member[j].secondary;
+        }
+    }
+
+    /* Sum with defined wrap around, as secondaries can outgrow an int in long runs. */
+
+    static int Add(int a, int b){
+        return (int)((unsigned)a + (unsigned)b);
+    }
+
+public:
+    /* Default constructor.
+       Establishes the relational context of each node with its neighbors as a linked list. */
+
+    System(int _SYSTEM_SIZE){
+        graph = Graph::List(_SYSTEM_SIZE);
+        ownsGraph = true;
+        Init();
+    }
+
+    /* Builds the system on an existing topology, which must outlive it. */
+
+    System(const Graph* _graph){
+        graph = _graph;
+        ownsGraph = false;
+        Init();
+    }
+
+    ~System(){
+        delete[] member;
+        if (ownsGraph){
+            delete graph;
+        }
+    }
+
+    void Init(){
+        SYSTEM_SIZE = graph->Size();
+        member = new Node[SYSTEM_SIZE];
+        heatmap = NULL;
+        tracer = NULL;
+        watch = NULL;
+        progress = NULL;
+        schedule = NULL;
+        scheduler = NULL;
+        exhausted = false;
+        halted = false;
+        Restart();
+        watchStep = 0;
+        constants = RuleConstants::Default();
+        faultCount = 0;
+        Reset();
+        random.Seed(rand());
+    }
+
+    int Size(){
+        return SYSTEM_SIZE;
+    }
+
+    const Graph& Topology(){
+        return *graph;
+    }
+
+    /* Replaces the rule constants and resets the system to the new initial secondary. */
+
+    void SetConstants(const RuleConstants& _constants){
+        constants = _constants;
+        Reset();
+    }
+
+    /* Attaches per-node counters that Stabilize() adds to, or detaches them with NULL. */
+
+    void SetHeatmap(Heatmap* _heatmap){
+        heatmap = _heatmap;
+    }
+
+    /* Attaches a sampling step tracer, or detaches it with NULL. */
+
+    void SetTracer(StepTracer* _tracer){
+        tracer = _tracer;
+        Restart();
+    }
+
+    /* Attaches watchpoints, or detaches them with NULL. */
+
+    void SetWatchpoints(Watchpoints* _watch){
+        watch = _watch;
+        Reset();
+    }
+
+    /* Attaches published progress and cancellation, or detaches it with NULL. */
+
+    void SetProgress(Progress* _progress){
+        progress = _progress;
+        Restart();
+    }
+
+    /* Replays a log in place of the random scheduler from every Reset, or restores the
+       random scheduler with NULL. */
+
+    void SetSchedule(ActivationLog::Cursor* _schedule){
+        schedule = _schedule;
+        Reset();
+    }
+
+    /* Selects nodes with a fair or locally central Scheduler from every Reset, or restores
+       the random scheduler with NULL. A replayed log takes precedence. */
+
+    void SetScheduler(Scheduler* _scheduler){
+        scheduler = _scheduler;
+        Reset();
+    }
+
+    /* Rounds of the Scheduler since Reset, 0 without one. */
+
+    int64_t Rounds(){
+        return (scheduler != NULL) ? scheduler->Rounds() : 0;
+    }
+
+    /* True when a watchpoint, cancellation or the end of the replayed log stopped the last
+       Stabilize. */
+
+    bool Halted(){
+        return halted;
+    }
+
+    /* True when the replayed log ended before the system stabilized. */
+
+    bool Exhausted(){
+        return exhausted;
+    }
+
+    /* Turns fault causality labelling on or off.
+       Fault k (counted from Reset) labels its node with bit k; every flip passes the
+       flipping node's labels to the neighbors it now disagrees with, so a rule firing can
+       be attributed to the faults whose disagreement reached the node. Faults beyond the
+       64th share bits with earlier ones. */
+
+    void EnableCausality(bool enable){
+        label.assign(enable ? SYSTEM_SIZE : 0, 0);
+        fired.assign(enable ? SYSTEM_SIZE : 0, 0);
+        distance.assign(enable ? SYSTEM_SIZE : 0, -1);
+        Reset();
+    }
+
+    /* Adds the current trial's per-fault containment to stats: the distinct nodes that fired
+       on behalf of each fault and the containment radius, the greatest distance from the
+       fault's origin to such a node within the region carrying its label. */
+
+    void CollectCausality(CausalityStats& stats){
+        if (label.empty()){
+            return;
+        }
+        for (int b = 0; b < min(faultCount, 64); b++){
+            uint64_t bit = (uint64_t)1 << b;
+            int64_t radius = 0;
+
+            queue.assign(1, origin[b]);
+            distance[origin[b]] = 0;
+            for (size_t head = 0; head < queue.size(); head++){
+                int v = queue[head];
+
+                if (fired[v] & bit){
+                    radius = max(radius, (int64_t)distance[v]);
+                }
+                for (const int* j = graph->Begin(v); j != graph->End(v); j++){
+                    if ((distance[*j] < 0) && (label[*j] & bit)){
+                        distance[*j] = distance[v] + 1;
+                        queue.push_back(*j);
+                    }
+                }
+            }
+            // Only the nodes this search reached are reset, keeping a trial's cost independent of the size.
+            for (size_t k = 0; k < queue.size(); k++){
+                distance[queue[k]] = -1;
+            }
+
+            stats.faults++;
+            stats.reached += reach[b];
+            stats.radius += radius;
+            stats.maxRadius = max(stats.maxRadius, radius);
+        }
+        stats.firings += trial.firings;
+        stats.interacting += trial.interacting;
+    }
+
+    /* Reseeds the scheduler, making a trial reproducible independent of other threads. */
+
+    void Seed(uint64_t seed){
+        random.Seed(seed);
+    }
+
+    /* Restores every node to its initial state so the system can be reused for another trial. */
+
+    void Reset(){
+        for (int i = 0; i < SYSTEM_SIZE; i++){
+            member[i].primary = 0;
+            member[i].secondary = constants.initial;
+            member[i].unequal = 0;
+            member[i].neighborMax = constants.initial;
+        }
+        disagree = 0;
+        enabled = 0;
+        node = &member[0];  // Set the node to the first node
+
+        if (!label.empty()){
+            fill(label.begin(), label.end(), 0);
+            fill(fired.begin(), fired.end(), 0);
+            memset(reach, 0, sizeof(reach));
+            trial = CausalityStats();
+        }
+        faultCount = 0;
+
+        if (watch != NULL){
+            watch->Reset(SYSTEM_SIZE);
+        }
+        if (halted){
+            halted = false;
+            Restart();
+        }
+        if (schedule != NULL){
+            schedule->Rewind();
+        }
+        if (scheduler != NULL){
+            scheduler->Reset();
+        }
+        exhausted = false;
+        watchStep = 0;
+    }
+
+    /* Random scheduler, or the replayed log or Scheduler when one is set.
+       Directs node* to a random member[]. 
+       The scheduler chooses the ith node. */
+
+    void SelectNode(){
+        int i = ((schedule == NULL) && (scheduler == NULL)) ? random.Below(SYSTEM_SIZE) : Scheduled();  // Random index
+
+        node = &member[i];  // ith node
+    }
+
+    /* Next node of the replayed log, or of the Scheduler. At the end of the log, halts
+       Stabilize before the step. */
+
+    int Scheduled(){
+        if (schedule == NULL){
+            int i = scheduler->Next(random);
+
+            scheduler->Moved(member[i].unequal > 0);
+            return i;
+        }
+
+        int i = schedule->Next();
+
+        if (i < 0){
+            exhausted = true;
+            halted = true;
+            countdown = 1;
+            return 0;
+        }
+        return i;
+    }
+
+    /* Simulates a transient fault within the system.
+       Only effects primary variables. Fault sites stay random when the scheduler is replayed. */
+
+    void TransientFault(){
+        TransientFault(random.Below(SYSTEM_SIZE));
+    }
+
+    /* Simulates a transient fault at the ith node. */
+
+    void TransientFault(int i){
+        if (!label.empty()){
+            if (faultCount < 64){
+                origin[faultCount] = i;
+            }
+            label[i] |= (uint64_t)1 << (faultCount % 64);
+        }
+        if (watch != NULL){
+            watch->Fault(*graph, i);
+        }
+        faultCount++;
+        Flip(i);
+    }
+
+    /* Checks if the system is in legal configuration.
+       The system is legal when every node's primary value equals those of its neighbors,
+       which on a connected topology means all primary values are equal. */
+
+    bool LegalConfig(){
+        return disagree == 0;
+    }
+
+    /* Number of edges whose endpoints currently disagree. */
+
+    int64_t Disagreement(){
+        return disagree;
+    }
+
+    /* Stabilization implementation.
+       Processes until legal configuration condition is met, or until budget steps
+       have been taken when budget is not negative.
+       Returns the number of scheduler steps taken. */
+
+    long Stabilize(bool verbose = true, long budget = -1){
+        long steps = 0;
+
+        while (!LegalConfig() && (steps != budget)){
+            SelectNode();
+            watchStep = ++steps;
+            if ((--countdown == 0) && Pause(steps)){
+                steps--;    // Aborted, the selected step is not taken
+                break;
+            }
+            if (heatmap != NULL){
+                heatmap->Add(node - member, Heatmap::SELECTED);
+            }
+            
+            // If true, then (2) is not satisfied.
+            if (!CheckUnequal()){
+                CheckConditions();
+            }
+            //Print();
+        }
+        if (progress != NULL){
+            Publish(steps);
+        }
+
+        if (verbose && (steps != budget)){
+            cout << "\nSYSTEM LEGAL\n";
+        }
+        return steps;
+    }
+
+    /* Checks if the primary values of the nodes in the local neighborhood are unequal.
+       Returns true when the step is complete: either every neighbor has a different
+       primary value and the node updates (3), or every neighbor agrees and nothing happens.
+       Returns false when only some neighbors differ, so Rules 2a or 2b apply. */
+
+    bool CheckUnequal(){
+        int degree = graph->Degree(node - member);
+
+        // All neighbors have the same state as the ith (or it has none), do nothing.
+        if (node->unequal == 0){
+            return true;
+        }
+        // All neighbors have a different state, update the node since (3) is satisfied.
+        else if (node->unequal == degree){
+            Flip(node - member);
+            if (heatmap != NULL){
+                heatmap->Add(node - member, Heatmap::FLIPPED);
+            }
+            if (!label.empty()){
+                Fired(node - member);
+            }
+            return true;
+        }
+        // Else check other Rules
+        else {
+            return false;
+        }
+    }
+
+    /* Checks conditions when there exists some neighbor of the ith node 
+       which has a different state than the ith node, but not all neighbors
+       have a different state.
+       Checks if the node satisfies Rules 2a or 2b. */
+
+    void CheckConditions(){
+        int i = node - member;
+
+        // If 2a is true
+        if (isLeader()){
+            Flip(i);
+            SetSecondary(i, Add(node->secondary, Add(Max(), constants.m)));
+            if (heatmap != NULL){
+                heatmap->Add(i, Heatmap::FLIPPED);
+                heatmap->Add(i, Heatmap::RULE_2A);
+            }
+        }
+        // If 2b is true
+        else {
+            SetSecondary(i, Add(node->secondary, constants.increment));
+            if (heatmap != NULL){
+                heatmap->Add(i, Heatmap::RULE_2B);
+            }
+        }
+        if (!label.empty()){
+            Fired(i);
+        }
+    }
+
+    /* Checks if the current node is the local leader. O(1) from the cached neighborhood maximum. */
+
+    bool isLeader(){
+        return node->secondary >= node->neighborMax;
+    }
+
+    /* Returns the greatest secondary value among the neighbor nodes. */
+
+    int Max(){
+        return node->neighborMax;
+    }
+
+    /* Calls the Print() function of each node in the system in index order. */
+
+    void Print(){
+        for (int i = 0; i < SYSTEM_SIZE; i++){
+            member[i].Print();
+        }
+
+        cout << '\n';
+    }
+};
+
+/* Linked list topology for FixedSystem.
+   A missing neighbor is replaced by a copy of the present one, so every node has exactly
+   two neighbor slots and the rules need no NULL checks:
+   an end node sees its single neighbor twice, which leaves rules (2) and (3) unchanged. */
+
+struct ListTopology {
+    static constexpr int Left(int i, int){
+        return (i == 0) ? 1 : i - 1;
+    }
+
+    static constexpr int Right(int i, int n){
+        return (i == n - 1) ? n - 2 : i + 1;
+    }
+
+    // Number of distinct neighbors, used to keep the disagreement count exact.
+    static constexpr int Degree(int i, int n){
+        return ((i == 0) || (i == n - 1)) ? 1 : 2;
+    }
+};
+
+/* Compile-time neighbor table of a FixedSystem. */
+
+template <int N>
+struct NeighborTable {
+    int left[N];
+    int right[N];
+    int degree[N];
+};
+
+template <int N, class Topology, size_t... I>
+constexpr NeighborTable<N> MakeNeighborTable(index_sequence<I...>){
+    return NeighborTable<N>{ { Topology::Left(I, N)... },
+                             { Topology::Right(I, N)... },
+                             { Topology::Degree(I, N)... } };
+}
+
+/* Fixed-size system for small-n studies.
+   Same algorithm as System, but the nodes live in std::array on the stack, the neighbor
+   table is built at compile time and legality is tracked by a count of disagreeing edges
+   instead of rescanning every node after each step. */
+
+template <int N, class Topology>
+class FixedSystem {
+private:
+    static_assert(N >= 2, "FixedSystem requires at least two nodes");
+    static constexpr NeighborTable<N> table = MakeNeighborTable<N, Topology>(make_index_sequence<N>());
+
+    array<int, N> primary;      // Primary attributes
+    array<int, N> secondary;    // Secondary attributes
+    int disagree;               // Number of edges whose endpoints have unequal primaries
+    Random random;              // Scheduler randomness
+
+public:
+    FixedSystem(uint64_t seed = 1) : random(seed){
+        Reset();
+    }
+
+    /* Restores every node to its initial state. */
+
+    void Reset(){
+        primary.fill(0);
+        secondary.fill(5);  // Arbitrary value, as in Node
+        disagree = 0;
+    }
+
+    void Seed(uint64_t seed){
+        random.Seed(seed);
+    }
+
+    /* Number of neighbor slots of node i whose primary differs from it (0, 1 or 2). */
+
+    int Unequal(int i) const {
+        return (primary[table.left[i]] != primary[i]) + (primary[table.right[i]] != primary[i]);
+    }
+
+    /* Flips a random node's primary value. Only effects primary variables. */
+
+    void TransientFault(){
+        TransientFault(random.Below(N));
+    }
+
+    /* Flips the ith node's primary value. */
+
+    void TransientFault(int i){
+        disagree += table.degree[i] * (1 - Unequal(i));
+        primary[i] ^= 1;
+    }
+
+    /* True when no edge has endpoints with unequal primaries. */
+
+    bool Legal() const {
+        return disagree == 0;
+    }
+
+    /* Full scan of the primary values; the loop bound is a constant so it is unrolled. */
+
+    bool LegalConfig() const {
+        bool legal = true;
+
+        for (int i = 1; i < N; i++){
+            legal &= (primary[i] == primary[0]);
+        }
+        return legal;
+    }
+
+    /* Stabilization implementation, see System::Stabilize().
+       Returns the number of scheduler steps taken. */
+
+    long Stabilize(long budget = -1){
+        long steps = 0;
+
+        while ((disagree != 0) && (steps != budget)){
+            int i = random.Below(N);
+            int l = table.left[i];
+            int r = table.right[i];
+            int unequal = Unequal(i);
+            steps++;
+
+            // (3) Both neighbor slots differ: update, every incident edge now agrees.
+            if (unequal == 2){
+                primary[i] ^= 1;
+                disagree -= table.degree[i];
+            }
+            // (2) Exactly one neighbor differs, only possible for an interior node.
+            else if (unequal == 1){
+                int max = (secondary[l] > secondary[r]) ? secondary[l] : secondary[r];
+
+                // 2a: local leader, flipping moves the disagreement but does not change the count.
+                if (secondary[i] >= max){
+                    primary[i] ^= 1;
+                    secondary[i] = (int)((unsigned)secondary[i] + (unsigned)max + M);   // Wraps as in System
+                }
+                // 2b
+                else {
+                    secondary[i]++;
+                }
+            }
+        }
+        return steps;
+    }
+};
+
+template <int N, class Topology>
+constexpr NeighborTable<N> FixedSystem<N, Topology>::table;
+
+/* Totals of a batch of trials. Steps are only summed over trials that stabilized. */
+
+struct TrialTotals {
+    long steps;         // Scheduler steps of the stabilized trials
+    int stabilized;     // Trials that reached legal configuration within the budget
+};
+
+/* Running count, mean and variance (Welford), mergeable by the parallel formula of Chan et al. */
+
+class Welford {
+private:
+    int64_t count;
+    double mean;
+    double m2;      // Sum of squared deviations from the mean
+
+public:
+    Welford() : count(0), mean(0), m2(0){}
+
+    void Add(double x){
+        double delta = x - mean;
+
+        count++;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    void Merge(const Welford& other){
+        if (other.count == 0){
+            return;
+        }
+        double delta = other.mean - mean;
+        int64_t total = count + other.count;
+
+        m2 += other.m2 + delta * delta * count * other.count / total;
+        mean += delta * other.count / total;
+        count = total;
+    }
+
+    int64_t Count() const {
+        return count;
+    }
+
+    double Mean() const {
+        return mean;
+    }
+
+    double Deviation() const {
+        return (count > 1) ? sqrt(m2 / (count - 1)) : 0;
+    }
+};
+
+/* KLL quantile sketch (Karnin, Lang, Liberty).
+   Level h holds items of weight 2^h; when the sketch is over capacity the lowest full
+   level is sorted and every other item (from a random offset) is promoted. Memory is
+   O(k) regardless of the number of items, and sketches merge by concatenating levels.
+   The promotion offsets are drawn from seed, so independent sketches should get
+   independent seeds, e.g. MixSeed of their worker. */
+
+class QuantileSketch {
+private:
+    int k;
+    vector< vector<double> > levels;
+    Random random;
+
+    /* Capacity of level h: k at the top, shrinking by 2/3 per level below, at least 2. */
+
+    int Capacity(int h) const {
+        int depth = levels.size() - 1 - h;
+        return max(2, (int)(k * pow(2.0 / 3.0, depth)));
+    }
+
+    size_t Size() const {
+        size_t size = 0;
+
+        for (size_t h = 0; h < levels.size(); h++){
+            size += levels[h].size();
+        }
+        return size;
+    }
+
+    size_t TotalCapacity() const {
+        size_t capacity = 0;
+
+        for (size_t h = 0; h < levels.size(); h++){
+            capacity += Capacity(h);
+        }
+        return capacity;
+    }
+
+    void Compress(){
+        while (Size() > TotalCapacity()){
+            for (size_t h = 0; h < levels.size(); h++){
+                if ((int)levels[h].size() >= Capacity(h)){
+                    if (h + 1 == levels.size()){
+                        levels.push_back(vector<double>());
+                    }
+                    vector<double>& level = levels[h];
+                    double kept = 0;
+                    bool odd = (level.size() % 2 == 1);
+
+                    // An odd item stays behind so no weight is lost.
+                    sort(level.begin(), level.end());
+                    if (odd){
+                        kept = level.back();
+                        level.pop_back();
+                    }
+                    for (size_t i = random.Next() & 1; i < level.size(); i += 2){
+                        levels[h + 1].push_back(level[i]);
+                    }
+                    level.clear();
+                    if (odd){
+                        level.push_back(kept);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+public:
+    QuantileSketch(int _k = 1024, uint64_t seed = 1) : k(_k), levels(1), random(seed){}
+
+    void Add(double x){
+        levels[0].push_back(x);
+        if (levels[0].size() >= (size_t)Capacity(0)){
+            Compress();
+        }
+    }
+
+    void Merge(const QuantileSketch& other){
+        while (levels.size() < other.levels.size()){
+            levels.push_back(vector<double>());
+        }
+        for (size_t h = 0; h < other.levels.size(); h++){
+            levels[h].insert(levels[h].end(), other.levels[h].begin(), other.levels[h].end());
+        }
+        Compress();
+    }
+
+    /* Number of items added, counting merged sketches. */
+
+    int64_t Count() const {
+        int64_t count = 0;
+
+        for (size_t h = 0; h < levels.size(); h++){
+            count += (int64_t)levels[h].size() << h;
+        }
+        return count;
+    }
+
+    /* Approximate q-quantile, 0 <= q <= 1. Returns 0 for an empty sketch. */
+
+    double Quantile(double q) const {
+        vector< pair<double, int64_t> > items;
+        int64_t total = 0, running = 0;
+
+        for (size_t h = 0; h < levels.size(); h++){
+            for (size_t i = 0; i < levels[h].size(); i++){
+                items.push_back(make_pair(levels[h][i], (int64_t)1 << h));
+                total += (int64_t)1 << h;
+            }
+        }
+        if (items.empty()){
+            return 0;
+        }
+        sort(items.begin(), items.end());
+        for (size_t i = 0; i < items.size(); i++){
+            running += items[i].second;
+            if (running >= q * total){
+                return items[i].first;
+            }
+        }
+        return items.back().first;
+    }
+};
+
+/* Kaplan-Meier survival of stabilization time with right censoring.
+   Trials that stabilize are events at their step count; trials that exhaust the step
+   budget are censored there, so capping expensive runs does not bias the estimate the
+   way averaging only the completed runs does. Times are binned exactly below 64 steps and
+   in 32 geometric bins per octave above (about 2% resolution), so the estimator uses
+   constant memory and merges by adding bins. */
+
+class Survival {
+private:
+    vector<int64_t> events;     // Stabilized trials per bin
+    vector<int64_t> censored;   // Budget exhausted trials per bin
+
+    static int Bin(int64_t t){
+        if (t < 64){
+            return (int)t;
+        }
+        int octave = 63 - __builtin_clzll(t);
+        return 64 + (octave - 6) * 32 + (int)((t >> (octave - 5)) & 31);
+    }
+
+    /* Upper edge of bin b, the first time not in it. */
+
+    static double Upper(int b){
+        if (b < 64){
+            return b + 1;
+        }
+        int octave = (b - 64) / 32 + 6;
+        return (double)(33 + (b - 64) % 32) * pow(2.0, octave - 5);
+    }
+
+    static double Lower(int b){
+        return (b == 0) ? 0 : Upper(b - 1);
+    }
+
+    void Count(vector<int64_t>& bins, int64_t t){
+        int b = Bin(max((int64_t)0, t));
+
+        if ((int)bins.size() <= b){
+            events.resize(b + 1, 0);
+            censored.resize(b + 1, 0);
+        }
+        bins[b]++;
+    }
+
+public:
+    void Event(int64_t t){
+        Count(events, t);
+    }
+
+    void Censor(int64_t t){
+        Count(censored, t);
+    }
+
+    void Merge(const Survival& other){
+        if (events.size() < other.events.size()){
+            events.resize(other.events.size(), 0);
+            censored.resize(other.censored.size(), 0);
+        }
+        for (size_t b = 0; b < other.events.size(); b++){
+            events[b] += other.events[b];
+            censored[b] += other.censored[b];
+        }
+    }
+
+    /* Survival curve as (time, S(time)) at the upper edge of every bin with events.
+       Within a bin events are taken before censoring. */
+
+    vector< pair<double, double> > Curve() const {
+        vector< pair<double, double> > curve;
+        int64_t atRisk = 0;
+        double s = 1;
+
+        for (size_t b = 0; b < events.size(); b++){
+            atRisk += events[b] + censored[b];
+        }
+        curve.push_back(make_pair(0.0, 1.0));
+        for (size_t b = 0; b < events.size(); b++){
+            if (events[b] > 0){
+                s *= 1.0 - (double)events[b] / atRisk;
+                curve.push_back(make_pair(Upper(b), s));
+            }
+            atRisk -= events[b] + censored[b];
+        }
+        return curve;
+    }
+
+    /* Restricted mean stabilization time: the area under S(t) on [0, tau].
+       S is taken to fall linearly across each bin. */
+
+    double RestrictedMean(double tau) const {
+        int64_t atRisk = 0;
+        double s = 1, area = 0;
+
+        if (events.empty()){
+            return 0;
+        }
+        for (size_t b = 0; b < events.size(); b++){
+            atRisk += events[b] + censored[b];
+        }
+        for (size_t b = 0; (b < events.size()) && (Lower(b) < tau); b++){
+            double after = s;
+            double width = min(Upper(b), tau) - Lower(b);
+
+            if ((events[b] > 0) && (atRisk > 0)){
+                after = s * (1.0 - (double)events[b] / atRisk);
+            }
+            area += width * (s + after) / 2;
+            s = after;
+            atRisk -= events[b] + censored[b];
+        }
+        if ((double)Upper(events.size() - 1) < tau){
+            area += (tau - Upper(events.size() - 1)) * s;
+        }
+        return area;
+    }
+
+    /* Kaplan-Meier estimate of the q-quantile of stabilization time, or -1 when the curve
+       does not fall to 1 - q before censoring. */
+
+    double Quantile(double q) const {
+        vector< pair<double, double> > curve = Curve();
+
+        for (size_t i = 1; i < curve.size(); i++){
+            if (curve[i].second <= 1.0 - q){
+                return curve[i].first;
+            }
+        }
+        return -1;
+    }
+};
+
+/* Distribution of steps and wall time over the stabilized trials of a batch, and the
+   survival of all trials with budget exhausted ones censored, in constant memory.
+   One per worker thread, merged by the batch driver. */
+
+struct TrialStatistics {
+    Welford steps;
+    Welford time;                   // Microseconds
+    QuantileSketch stepQuantiles;
+    QuantileSketch timeQuantiles;
+    Survival survival;
+
+    TrialStatistics(uint64_t seed = 1) : stepQuantiles(1024, MixSeed(seed, 1, 0)), timeQuantiles(1024, MixSeed(seed, 2, 0)){}
+
+    /* Records a trial that stabilized. */
+
+    void Add(long _steps, double microseconds){
+        steps.Add(_steps);
+        time.Add(microseconds);
+        stepQuantiles.Add(_steps);
+        timeQuantiles.Add(microseconds);
+        survival.Event(_steps);
+    }
+
+    /* Records a trial that exhausted its budget after _steps steps. */
+
+    void Censor(long _steps){
+        survival.Censor(_steps);
+    }
+
+    void Merge(const TrialStatistics& other){
+        steps.Merge(other.steps);
+        time.Merge(other.time);
+        stepQuantiles.Merge(other.stepQuantiles);
+        timeQuantiles.Merge(other.timeQuantiles);
+        survival.Merge(other.survival);
+    }
+
+    /* "restricted_mean km_p50" of steps over all trials, censored at the budget. The
+       restricted mean is taken up to tau = budget, as in the other modes, so that cells
+       with and without censored trials are comparable. */
+
+    string SurvivalColumns(long budget) const {
+        stringstream line;
+
+        line << survival.RestrictedMean(budget) << ' ' << survival.Quantile(0.5);
+        return line.str();
+    }
+
+    /* "mean sd p50 p99 p99.9" of steps then of microseconds, over stabilized trials. */
+
+    string Columns() const {
+        stringstream line;
+
+        line << steps.Mean() << ' ' << steps.Deviation() << ' ' << stepQuantiles.Quantile(0.5) << ' '
+             << stepQuantiles.Quantile(0.99) << ' ' << stepQuantiles.Quantile(0.999) << ' '
+             << time.Mean() << ' ' << time.Deviation() << ' ' << timeQuantiles.Quantile(0.5) << ' '
+             << timeQuantiles.Quantile(0.99) << ' ' << timeQuantiles.Quantile(0.999);
+        return line.str();
+    }
+};
+
+/* Microseconds since an arbitrary epoch, for timing single trials. */
+
+double Microseconds(){
+    return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Runs a number of independent fault/stabilize trials on a fixed-size list. */
+
+template <int N>
+TrialTotals FixedTrials(int faults, int trials, long budget, uint64_t seed){
+    FixedSystem<N, ListTopology> graph(seed);
+    TrialTotals totals = { 0, 0 };
+
+    for (int t = 0; t < trials; t++){
+        graph.Reset();
+        for (int i = 0; i < faults; i++){
+            graph.TransientFault();
+        }
+        long steps = graph.Stabilize(budget);
+        if (graph.Legal()){
+            totals.steps += steps;
+            totals.stabilized++;
+        }
+    }
+    return totals;
+}
+
+/* Runs a number of independent fault/stabilize trials on an existing System. */
+
+TrialTotals SystemTrials(System& graph, int faults, int trials, long budget){
+    TrialTotals totals = { 0, 0 };
+
+    for (int t = 0; t < trials; t++){
+        graph.Reset();
+        for (int i = 0; i < faults; i++){
+            graph.TransientFault();
+        }
+        long steps = graph.Stabilize(false, budget);
+        if (graph.LegalConfig()){
+            totals.steps += steps;
+            totals.stabilized++;
+        }
+    }
+    return totals;
+}
+
+/* Runs the trials on the heap allocated System, used for sizes without a fixed engine. */
+
+TrialTotals DynamicTrials(int size, int faults, int trials, long budget, uint64_t seed){
+    System graph(size);
+
+    graph.Seed(seed);
+    return SystemTrials(graph, faults, trials, budget);
+}
+
+/* Runs trials on a pool of threads, each with its own System on one shared list. */
+
+TrialTotals ParallelTrials(int size, int faults, int trials, long budget, uint64_t seed, int threads){
+    Graph* list = Graph::List(size);
+    vector<TrialTotals> partial(max(1, threads));
+    TrialTotals totals = { 0, 0 };
+
+    ParallelFor(threads, trials, [&](int t, int64_t begin, int64_t end){
+        System graph(list);
+
+        graph.Seed(MixSeed(seed, t, 0));
+        partial[t] = SystemTrials(graph, faults, end - begin, budget);
+    });
+    for (size_t t = 0; t < partial.size(); t++){
+        totals.steps += partial[t].steps;
+        totals.stabilized += partial[t].stabilized;
+    }
+    delete list;
+    return totals;
+}
+
+/* Trials with pre-drawn fault sites (faults per trial) on a System or a list FixedSystem.
+   Both engines draw the scheduler from one stream in the same way, so with equal seeds and
+   sites they take identical steps and the choice of engine does not change results. */
+
+long EngineSteps(System& engine, long budget){
+    return engine.Stabilize(false, budget);
+}
+
+template <int N, class Topology>
+long EngineSteps(FixedSystem<N, Topology>& engine, long budget){
+    return engine.Stabilize(budget);
+}
+
+template <class Engine>
+void SiteTrials(Engine& engine, const int* site, int faults, int trials, long budget,
+                TrialTotals& totals, TrialStatistics& statistics){
+    for (int t = 0; t < trials; t++){
+        engine.Reset();
+        for (int i = 0; i < faults; i++){
+            engine.TransientFault(*site++);
+        }
+        double start = Microseconds();
+        long steps = EngineSteps(engine, budget);
+        if (engine.LegalConfig()){
+            totals.steps += steps;
+            totals.stabilized++;
+            statistics.Add(steps, Microseconds() - start);
+        }
+        else {
+            statistics.Censor(steps);
+        }
+    }
+}
+
+template <int N>
+void FixedSiteTrials(uint64_t seed, const int* site, int faults, int trials, long budget,
+                     TrialTotals& totals, TrialStatistics& statistics){
+    FixedSystem<N, ListTopology> engine(seed);
+
+    SiteTrials(engine, site, faults, trials, budget, totals, statistics);
+}
+
+/* Site trials on the FixedSystem of a list of size nodes.
+   Returns false when there is no fixed engine of that size. */
+
+bool FixedSiteTrials(int size, uint64_t seed, const int* site, int faults, int trials, long budget,
+                     TrialTotals& totals, TrialStatistics& statistics){
+    switch (size){
+        case 8:   FixedSiteTrials<8>(seed, site, faults, trials, budget, totals, statistics);   return true;
+        case 16:  FixedSiteTrials<16>(seed, site, faults, trials, budget, totals, statistics);  return true;
+        case 32:  FixedSiteTrials<32>(seed, site, faults, trials, budget, totals, statistics);  return true;
+        case 64:  FixedSiteTrials<64>(seed, site, faults, trials, budget, totals, statistics);  return true;
+        case 128: FixedSiteTrials<128>(seed, site, faults, trials, budget, totals, statistics); return true;
+        case 256: FixedSiteTrials<256>(seed, site, faults, trials, budget, totals, statistics); return true;
+        default:  return false;
+    }
+}
+
+/* Execution engines of the batch drivers. */
+
+enum Engine { ENGINE_FIXED, ENGINE_SYSTEM, ENGINE_PARALLEL, ENGINES };
+
+const char* engineNames[ENGINES] = { "fixed", "system", "parallel" };
+
+/* Chooses the fastest engine for a (size, faults) list cell.
+   Each candidate (the fixed engine where one exists, System, and the parallel driver at
+   2, 4, ... threads) runs short probes on the same fault sites until they take 50ms, and
+   the one with the most steps per second wins; trials per second would be dominated by the
+   heavy tail of trial lengths. A cell with a single candidate is not probed. Decisions are kept in a file per machine, named by a hash of
+   the CPU model, core count and host name, under the topology cache directory or
+   ~/.stabilization. */
+
+class EngineTuner {
+public:
+    struct Choice {
+        Engine engine;
+        int threads;
+        double rate;            // Steps per second of the probe
+    };
+
+private:
+    string path;
+    map<string, Choice> decisions;  // Keyed by "size faults threads"
+    bool changed;
+
+    static uint64_t Hash(const string& text){
+        uint64_t h = 0xCBF29CE484222325ULL;    // FNV-1a
+
+        for (size_t i = 0; i < text.size(); i++){
+            h = (h ^ (unsigned char)text[i]) * 0x100000001B3ULL;
+        }
+        return h;
+    }
+
+    static bool HasFixed(int size){
+        return (size >= 8) && (size <= 256) && ((size & (size - 1)) == 0);
+    }
+
+public:
+    /* Steps per second of an engine on size nodes with faults faults. The parallel engine
+       splits the same sites into contiguous ranges, one System per thread. */
+
+    static double Probe(Engine engine, int threads, int size, int faults, long budget){
+        double elapsed = 0;
+        int64_t steps = 0;
+        uint64_t seed = MixSeed(1, size, faults);
+        Graph* list = (engine == ENGINE_PARALLEL) ? Graph::List(size) : NULL;
+
+        for (int trials = 4; (elapsed < 50000) && (trials <= (1 << 16)); trials *= 2){
+            Random random(seed);
+            vector<int> sites((size_t)faults * trials);
+            TrialTotals totals = { 0, 0 };
+            TrialStatistics statistics;
+
+            for (size_t i = 0; i < sites.size(); i++){
+                sites[i] = random.Below(size);
+            }
+            const int* site = sites.empty() ? NULL : &sites[0];
+            double start = Microseconds();
+            if (engine == ENGINE_PARALLEL){
+                vector<TrialTotals> partial(max(1, threads), totals);
+
+                ParallelFor(threads, trials, [&](int t, int64_t begin, int64_t end){
+                    System graph(list);
+                    TrialStatistics local;
+
+                    graph.Seed(seed);
+                    SiteTrials(graph, site + begin * faults, faults, end - begin, budget, partial[t], local);
+                });
+                for (size_t t = 0; t < partial.size(); t++){
+                    totals.steps += partial[t].steps;
+                    totals.stabilized += partial[t].stabilized;
+                }
+            }
+            else if ((engine == ENGINE_SYSTEM) || !FixedSiteTrials(size, seed, site, faults, trials, budget, totals, statistics)){
+                System graph(size);
+
+                graph.Seed(seed);
+                SiteTrials(graph, site, faults, trials, budget, totals, statistics);
+            }
+            elapsed = Microseconds() - start;
+            steps = totals.steps + (int64_t)(trials - totals.stabilized) * budget;
+        }
+        delete list;
+        return (elapsed > 0) ? steps / elapsed * 1e6 : 0;
+    }
+
+    /* Description of this machine: CPU model, cores and host name. */
+
+    static string Machine(){
+        ifstream cpuinfo("/proc/cpuinfo");
+        string line, model = "unknown";
+        char host[256] = "";
+        stringstream machine;
+
+        while (getline(cpuinfo, line)){
+            if (line.compare(0, 10, "model name") == 0){
+                model = line.substr(line.find(':') + 2);
+                break;
+            }
+        }
+        gethostname(host, sizeof(host) - 1);
+        machine << model << ", " << thread::hardware_concurrency() << " cores, " << host;
+        return machine.str();
+    }
+
+    /* Directory of the decision file: $STABILIZATION_CACHE or ~/.stabilization. */
+
+    static string Directory(){
+        const char* cache = getenv("STABILIZATION_CACHE");
+        const char* home = getenv("HOME");
+
+        if (cache != NULL){
+            return cache;
+        }
+        return string((home != NULL) ? home : ".") + "/.stabilization";
+    }
+
+    EngineTuner(const string& directory) : changed(false){
+        stringstream name;
+        ifstream in;
+        string line;
+
+        name << directory << "/engines-" << hex << Hash(Machine());
+        path = name.str();
+        in.open(path.c_str());
+        while (getline(in, line)){
+            stringstream fields(line);
+            string key[3], engine;
+            Choice choice;
+
+            if (line.empty() || (line[0] == '#') ||
+                !(fields >> key[0] >> key[1] >> key[2] >> engine >> choice.threads >> choice.rate)){
+                continue;
+            }
+            for (int e = 0; e < ENGINES; e++){
+                if (engine == engineNames[e]){
+                    choice.engine = (Engine)e;
+                    decisions[key[0] + ' ' + key[1] + ' ' + key[2]] = choice;
+                }
+            }
+        }
+    }
+
+    /* The fastest engine for a cell using at most threads threads, probing on first use. */
+
+    Choice Select(int size, int faults, int threads, long budget){
+        stringstream key;
+        vector<Choice> candidates;
+        Choice best = { ENGINE_SYSTEM, 1, 0 };
+
+        key << size << ' ' << faults << ' ' << threads;
+        map<string, Choice>::iterator known = decisions.find(key.str());
+        if (known != decisions.end()){
+            return known->second;
+        }
+
+        if (HasFixed(size)){
+            candidates.push_back(best);
+            candidates.back().engine = ENGINE_FIXED;
+        }
+        candidates.push_back(best);
+        for (int t = 2; t < 2 * threads; t *= 2){
+            candidates.push_back(best);
+            candidates.back().engine = ENGINE_PARALLEL;
+            candidates.back().threads = min(t, threads);
+        }
+        if (candidates.size() == 1){
+            return candidates[0];
+        }
+        for (size_t c = 0; c < candidates.size(); c++){
+            candidates[c].rate = Probe(candidates[c].engine, candidates[c].threads, size, faults, min(budget, 100000L));
+            if (candidates[c].rate > best.rate){
+                best = candidates[c];
+            }
+        }
+        decisions[key.str()] = best;
+        changed = true;
+        return best;
+    }
+
+    /* Writes the decisions if any were added, beside the file and then renamed over it. */
+
+    bool Save(){
+        stringstream temporary;
+        ofstream out;
+
+        if (!changed){
+            return true;
+        }
+        temporary << path << ".tmp" << getpid();
+        mkdir(path.substr(0, path.rfind('/')).c_str(), 0755);
+        out.open(temporary.str().c_str());
+        out << "# " << Machine() << "\n# size faults threads engine engine_threads steps_per_second\n";
+        for (map<string, Choice>::iterator d = decisions.begin(); d != decisions.end(); ++d){
+            out << d->first << ' ' << engineNames[d->second.engine] << ' ' << d->second.threads << ' '
+                << d->second.rate << '\n';
+        }
+        out.close();
+        changed = !(out && (rename(temporary.str().c_str(), path.c_str()) == 0));
+        if (changed){
+            unlink(temporary.str().c_str());
+        }
+        return !changed;
+    }
+};
+
+/* Batch driver: runs the trials on the engine the EngineTuner finds fastest here.
+   Each trial is abandoned after budget steps, since the algorithm is not guaranteed to
+   stabilize in bounded time. */
+
+int RunTrials(int size, int faults, int trials, long budget, uint64_t seed){
+    boost::posix_time::ptime start, stop;
+    TrialTotals totals;
+
+    if ((size < 2) || (faults < 0) || (trials < 1) || (budget < 1)){
+        cerr << "trials: expected size >= 2, faults >= 0, trials >= 1, budget >= 1\n";
+        return 1;
+    }
+
+    EngineTuner tuner(EngineTuner::Directory());
+    EngineTuner::Choice engine = tuner.Select(size, faults, min(trials, max(1, (int)thread::hardware_concurrency())), budget);
+    if (!tuner.Save()){
+        cerr << "trials: cannot store the engine decision in " << EngineTuner::Directory() << '\n';
+    }
+
+    start = boost::posix_time::microsec_clock::local_time();
+    switch ((engine.engine == ENGINE_FIXED) ? size : 0){
+        case 8:   totals = FixedTrials<8>(faults, trials, budget, seed);   break;
+        case 16:  totals = FixedTrials<16>(faults, trials, budget, seed);  break;
+        case 32:  totals = FixedTrials<32>(faults, trials, budget, seed);  break;
+        case 64:  totals = FixedTrials<64>(faults, trials, budget, seed);  break;
+        case 128: totals = FixedTrials<128>(faults, trials, budget, seed); break;
+        case 256: totals = FixedTrials<256>(faults, trials, budget, seed); break;
+        default:
+            if (engine.engine == ENGINE_PARALLEL){
+                totals = ParallelTrials(size, faults, trials, budget, seed, engine.threads);
+            }
+            else {
+                totals = DynamicTrials(size, faults, trials, budget, seed);
+            }
+    }
+    stop = boost::posix_time::microsec_clock::local_time();
+
+    double seconds = (stop - start).total_microseconds() / 1e6;
+    cout << "engine " << engineNames[engine.engine];
+    if (engine.engine == ENGINE_PARALLEL){
+        cout << " x" << engine.threads;
+    }
+    cout << ", size " << size << ", faults " << faults << ", trials " << trials << '\n';
+    cout << "stabilized: " << totals.stabilized << " within " << budget << " steps\n";
+    cout << "mean steps: " << (totals.stabilized ? (double)totals.steps / totals.stabilized : 0) << '\n';
+    cout << "trials/sec: " << (seconds > 0 ? trials / seconds : 0) << '\n';
+    return 0;
+}
+
+/* Command line options of the form --key value following a mode name. */
+
+class Options {
+private:
+    map<string, string> values;
+
+public:
+    Options(int argc, char* argv[], int first){
+        for (int i = first; i + 1 < argc; i += 2){
+            if (strncmp(argv[i], "--", 2) == 0){
+                values[argv[i] + 2] = argv[i + 1];
+            }
+        }
+    }
+
+    bool Has(const string& key) const {
+        return values.count(key) != 0;
+    }
+
+    string Get(const string& key, const string& fallback) const {
+        map<string, string>::const_iterator it = values.find(key);
+        return (it == values.end()) ? fallback : it->second;
+    }
+
+    long Get(const string& key, long fallback) const {
+        map<string, string>::const_iterator it = values.find(key);
+        return (it == values.end()) ? fallback : atol(it->second.c_str());
+    }
+
+    /* Parses a comma separated list of integers, e.g. --sizes 64,128,256. */
+
+    vector<int> List(const string& key, const string& fallback) const {
+        vector<int> list;
+        stringstream in(Get(key, fallback));
+        string item;
+
+        while (getline(in, item, ',')){
+            if (!item.empty()){
+                list.push_back(atoi(item.c_str()));
+            }
+        }
+        return list;
+    }
+};
+
+/* Bounded multi-producer multi-consumer queue (Vyukov).
+   Pushing and popping are lock-free; a caller that finds the queue full or empty sleeps on a
+   condition variable, which is only signalled while someone is waiting, so stages that wait
+   leave their cores to the stabilization workers.
+   The queue is closed once every registered producer has called Done(). */
+
+template <class T>
+class BoundedQueue {
+private:
+    struct Slot {
+        atomic<size_t> sequence;
+        T data;
+    };
+
+    Slot* buffer;
+    size_t mask;
+    char pad0[64];
+    atomic<size_t> enqueuePos;
+    char pad1[64];
+    atomic<size_t> dequeuePos;
+    char pad2[64];
+    atomic<int> producers;
+    atomic<int> waiting;            // Callers asleep or about to sleep in Push() or Pop()
+    mutex waitLock;
+    condition_variable changed;
+
+    /* Wakes the waiting callers after a push, pop or close. The fence pairs with the one in
+       Sleep(): either this sees the waiter, or the waiter's retry sees the change. */
+
+    void Wake(){
+        atomic_thread_fence(memory_order_seq_cst);
+        if (waiting.load(memory_order_relaxed) > 0){
+            lock_guard<mutex> guard(waitLock);
+            changed.notify_all();
+        }
+    }
+
+public:
+    /* Capacity is rounded up to a power of two. */
+
+    BoundedQueue(size_t capacity, int _producers){
+        size_t size = 2;
+
+        while (size < capacity){
+            size *= 2;
+        }
+        buffer = new Slot[size];
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++){
+            buffer[i].sequence.store(i, memory_order_relaxed);
+        }
+        enqueuePos.store(0, memory_order_relaxed);
+        dequeuePos.store(0, memory_order_relaxed);
+        producers.store(_producers);
+        waiting.store(0);
+    }
+
+    ~BoundedQueue(){
+        delete[] buffer;
+    }
+
+    bool TryPush(const T& item){
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+
+        for (;;){
+            Slot* slot = &buffer[pos & mask];
+            intptr_t diff = (intptr_t)slot->sequence.load(memory_order_acquire) - (intptr_t)pos;
+
+            if (diff == 0){
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)){
+                    slot->data = item;
+                    slot->sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0){
+                return false;   // Full
+            }
+            else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T& item){
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+
+        for (;;){
+            Slot* slot = &buffer[pos & mask];
+            intptr_t diff = (intptr_t)slot->sequence.load(memory_order_acquire) - (intptr_t)(pos + 1);
+
+            if (diff == 0){
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)){
+                    item = slot->data;
+                    slot->sequence.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0){
+                return false;   // Empty
+            }
+            else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    /* Blocks while the queue is full. */
+
+    void Push(const T& item){
+        if (!TryPush(item)){
+            unique_lock<mutex> guard(waitLock);
+
+            waiting.fetch_add(1);
+            atomic_thread_fence(memory_order_seq_cst);
+            while (!TryPush(item)){
+                changed.wait(guard);
+            }
+            waiting.fetch_sub(1);
+        }
+        Wake();
+    }
+
+    /* Blocks until an item is available.
+       Returns false once the queue is closed and drained. */
+
+    bool Pop(T& item){
+        bool popped = TryPop(item);
+
+        if (!popped){
+            unique_lock<mutex> guard(waitLock);
+
+            waiting.fetch_add(1);
+            atomic_thread_fence(memory_order_seq_cst);
+            while (!(popped = TryPop(item)) && (producers.load(memory_order_acquire) > 0)){
+                changed.wait(guard);
+            }
+            if (!popped){
+                popped = TryPop(item);
+            }
+            waiting.fetch_sub(1);
+        }
+        if (popped){
+            Wake();
+        }
+        return popped;
+    }
+
+    /* Called by each producer when it will push no more items. */
+
+    void Done(){
+        producers.fetch_sub(1, memory_order_release);
+        atomic_thread_fence(memory_order_seq_cst);
+        lock_guard<mutex> guard(waitLock);
+        changed.notify_all();
+    }
+};
+
+/* One (size, faults) point of a sweep as it moves through the pipeline.
+   The pool holds the Systems built for the cell; stabilization workers borrow them. */
+
+struct PipelineCell {
+    int size;
+    int faults;
+    int trials;
+    int chunks;                     // Number of jobs the cell is split into
+    Engine engine;                  // ENGINE_FIXED or ENGINE_SYSTEM
+    BoundedQueue<System*>* pool;    // Systems built for this cell
+    int poolSize;
+    boost::posix_time::ptime start; // When the topology stage began the cell
+    TrialTotals totals;             // Written by the aggregation stage only
+    TrialStatistics statistics;     // Written by the aggregation stage only
+    int done;                       // Jobs aggregated so far
+};
+
+/* A chunk of trials of one cell. Fault sites are generated before stabilization. */
+
+struct PipelineJob {
+    PipelineCell* cell;
+    int chunk;
+    int trials;
+    vector<int> sites;              // faults * trials node indices
+    TrialTotals totals;
+    TrialStatistics statistics;
+};
+
+/* Staged sweep: topology build -> fault generation -> stabilization -> aggregation -> writing.
+   Stages are connected by bounded lock-free queues and each has its own thread budget,
+   so building the next cell overlaps with stabilizing the current one and aggregation or
+   output never stalls the stabilization workers. */
+
+class Pipeline {
+private:
+    vector<PipelineCell> cells;
+    int builders;                   // Topology stage threads
+    int generators;                 // Fault generation stage threads
+    int workers;                    // Stabilization stage threads
+    int chunkTrials;                // Trials per job
+    long budget;                    // Step budget of each trial
+    uint64_t seed;
+    ostream& out;
+    string error;                   // Why the sweep cannot run, empty when it can
+
+    atomic<int> nextCell;
+    BoundedQueue<PipelineJob*> built;
+    BoundedQueue<PipelineJob*> faulted;
+    BoundedQueue<PipelineJob*> stabilized;
+    BoundedQueue<string> results;
+
+    /* Seeds depend on the cell parameters rather than its position, so a cell gives the
+       same results whichever sweep it is part of. */
+
+    static uint64_t CellKey(const PipelineCell& cell){
+        return ((uint64_t)cell.size << 32) | (uint32_t)cell.faults;
+    }
+
+    /* Topology stage: builds the System pool of a cell and emits its jobs. */
+
+    void Build(){
+        int c;
+
+        while ((c = nextCell.fetch_add(1)) < (int)cells.size()){
+            PipelineCell& cell = cells[c];
+
+            cell.start = boost::posix_time::microsec_clock::local_time();
+            if (cell.engine != ENGINE_FIXED){
+                cell.poolSize = min(workers, cell.chunks);
+                cell.pool = new BoundedQueue<System*>(cell.poolSize, 1);   // Never closed, so Pop() waits
+                for (int i = 0; i < cell.poolSize; i++){
+                    cell.pool->Push(new System(cell.size));
+                }
+            }
+            for (int k = 0; k < cell.chunks; k++){
+                PipelineJob* job = new PipelineJob();
+
+                job->cell = &cell;
+                job->chunk = k;
+                job->trials = min(chunkTrials, cell.trials - k * chunkTrials);
+                built.Push(job);
+            }
+        }
+        built.Done();
+    }
+
+    /* Fault generation stage: draws the fault sites of every trial in the job. */
+
+    void Generate(){
+        PipelineJob* job;
+
+        while (built.Pop(job)){
+            int size = job->cell->size;
+            Random random(MixSeed(seed, CellKey(*job->cell), job->chunk));
+
+            job->sites.resize((size_t)job->cell->faults * job->trials);
+            for (size_t i = 0; i < job->sites.size(); i++){
+                job->sites[i] = random.Below(size);
+            }
+            faulted.Push(job);
+        }
+        faulted.Done();
+    }
+
+    /* Stabilization stage: runs the trials of a job on the cell's engine, a stack allocated
+       FixedSystem or a System borrowed from the pool. Both give the same results. */
+
+    void Stabilize(){
+        PipelineJob* job;
+
+        while (faulted.Pop(job)){
+            PipelineCell& cell = *job->cell;
+            System* graph;
+            const int* site = job->sites.empty() ? NULL : &job->sites[0];
+            uint64_t schedule = MixSeed(seed, ~CellKey(cell), job->chunk);
+
+            job->totals.steps = 0;
+            job->totals.stabilized = 0;
+            if ((cell.engine != ENGINE_FIXED) ||
+                !FixedSiteTrials(cell.size, schedule, site, cell.faults, job->trials, budget, job->totals, job->statistics)){
+                cell.pool->Pop(graph);
+                graph->Seed(schedule);
+                SiteTrials(*graph, site, cell.faults, job->trials, budget, job->totals, job->statistics);
+                cell.pool->Push(graph);
+            }
+            stabilized.Push(job);
+        }
+        stabilized.Done();
+    }
+
+    /* Aggregation stage: folds job totals into their cell and releases finished cells. */
+
+    void Aggregate(){
+        PipelineJob* job;
+
+        while (stabilized.Pop(job)){
+            PipelineCell& cell = *job->cell;
+
+            cell.totals.steps += job->totals.steps;
+            cell.totals.stabilized += job->totals.stabilized;
+            cell.statistics.Merge(job->statistics);
+            delete job;
+
+            if (++cell.done == cell.chunks){
+                boost::posix_time::ptime stop = boost::posix_time::microsec_clock::local_time();
+                System* graph;
+                stringstream line;
+
+                while ((cell.pool != NULL) && cell.pool->TryPop(graph)){
+                    delete graph;
+                }
+                delete cell.pool;
+                cell.pool = NULL;
+
+                line << cell.size << ' ' << cell.faults << ' ' << cell.trials << ' ' << cell.totals.stabilized << ' '
+                     << cell.statistics.Columns() << ' ' << cell.statistics.SurvivalColumns(budget) << ' '
+                     << (stop - cell.start).total_microseconds() << '\n';
+                results.Push(line.str());
+            }
+        }
+        results.Done();
+    }
+
+    /* Writing stage. */
+
+    void Write(){
+        string line;
+
+        out << "# restricted_mean_steps is the area under the survival curve up to tau = budget = " << budget << " steps\n";
+        out << "# size faults trials stabilized mean_steps sd_steps p50_steps p99_steps p999_steps "
+               "mean_us sd_us p50_us p99_us p999_us restricted_mean_steps km_p50_steps microseconds\n";
+        while (results.Pop(line)){
+            out << line;
+        }
+        out.flush();
+    }
+
+public:
+    Pipeline(const vector<int>& sizes, const vector<int>& faults, int trials, long _budget, uint64_t _seed,
+             int _builders, int _generators, int _workers, int _chunkTrials, EngineTuner& tuner, ostream& _out)
+        : builders(_builders), generators(_generators), workers(_workers), chunkTrials(_chunkTrials),
+          budget(_budget), seed(_seed), out(_out), nextCell(0),
+          built(64, _builders), faulted(64, _generators), stabilized(256, _workers), results(64, 1){
+        for (size_t i = 0; i < sizes.size(); i++){
+            if (sizes[i] < 2){
+                error = "sizes must be at least 2";
+            }
+        }
+        for (size_t j = 0; j < faults.size(); j++){
+            if (faults[j] < 0){
+                error = "fault counts must not be negative";
+            }
+        }
+        if ((trials < 1) || (budget < 1) || (builders < 1) || (generators < 1) || (workers < 1) || (chunkTrials < 1)){
+            error = "expected trials, budget, builders, generators, workers and chunk >= 1";
+        }
+        if (!error.empty()){
+            return;
+        }
+        for (size_t i = 0; i < sizes.size(); i++){
+            for (size_t j = 0; j < faults.size(); j++){
+                PipelineCell cell;
+
+                cell.size = sizes[i];
+                cell.faults = faults[j];
+                cell.trials = trials;
+                cell.chunks = (trials + chunkTrials - 1) / chunkTrials;
+                cell.engine = tuner.Select(cell.size, cell.faults, 1, budget).engine;
+                cell.statistics = TrialStatistics(MixSeed(seed, CellKey(cell), 1));
+                cell.pool = NULL;
+                cell.poolSize = 0;
+                cell.totals.steps = 0;
+                cell.totals.stabilized = 0;
+                cell.done = 0;
+                cells.push_back(cell);
+            }
+        }
+    }
+
+    /* Why the sweep cannot run, or "" when it can. */
+
+    const string& Error() const {
+        return error;
+    }
+
+    /* Starts every stage and waits for the sweep to drain. */
+
+    void Run(){
+        vector<thread> threads;
+
+        for (int i = 0; i < builders; i++){
+            threads.push_back(thread(&Pipeline::Build, this));
+        }
+        for (int i = 0; i < generators; i++){
+            threads.push_back(thread(&Pipeline::Generate, this));
+        }
+        for (int i = 0; i < workers; i++){
+            threads.push_back(thread(&Pipeline::Stabilize, this));
+        }
+        threads.push_back(thread(&Pipeline::Aggregate, this));
+        threads.push_back(thread(&Pipeline::Write, this));
+
+        for (size_t i = 0; i < threads.size(); i++){
+            threads[i].join();
+        }
+    }
+};
+
+/* Sweep mode: runs every (size, faults) cell through the staged pipeline. */
+
+int RunPipeline(const Options& options){
+    vector<int> sizes = options.List("sizes", "64,128,256");
+    vector<int> faults = options.List("faults", "1,2,4");
+    int trials = options.Get("trials", 1000L);
+    long budget = options.Get("budget", 1000000L);
+    int cores = max(1, (int)thread::hardware_concurrency());
+    int workers = options.Get("workers", (long)max(1, cores - 2));
+    ofstream file;
+
+    if (options.Has("out")){
+        file.open(options.Get("out", "").c_str());
+        if (!file){
+            cerr << "pipeline: cannot open " << options.Get("out", "") << '\n';
+            return 1;
+        }
+    }
+
+    // Jobs already run in parallel, so each cell picks the faster single threaded engine.
+    EngineTuner tuner(EngineTuner::Directory());
+    Pipeline pipeline(sizes, faults, trials, budget, options.Get("seed", (long)rand()),
+                      options.Get("builders", 1L), options.Get("generators", 1L), workers,
+                      options.Get("chunk", 64L), tuner, options.Has("out") ? file : cout);
+    if (!pipeline.Error().empty()){
+        cerr << "pipeline: " << pipeline.Error() << '\n';
+        return 1;
+    }
+    if (!tuner.Save()){
+        cerr << "pipeline: cannot store engine decisions in " << EngineTuner::Directory() << '\n';
+    }
+    pipeline.Run();
+    return 0;
+}
+
+/* Fixed set of worker threads fed from a task queue.
+   Idle workers sleep on a condition variable, so a warm pool costs nothing between jobs. */
+
+class ThreadPool {
+private:
+    vector<thread> threads;
+    deque< function<void()> > tasks;
+    mutex lock;
+    condition_variable ready;
+    bool stopping;
+
+    void Work(){
+        for (;;){
+            function<void()> task;
+            {
+                unique_lock<mutex> guard(lock);
+                ready.wait(guard, [this]{ return stopping || !tasks.empty(); });
+                if (tasks.empty()){
+                    return;
+                }
+                task = tasks.front();
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    ThreadPool(int count) : stopping(false){
+        for (int i = 0; i < count; i++){
+            threads.push_back(thread(&ThreadPool::Work, this));
+        }
+    }
+
+    /* Finishes the queued tasks, then joins the workers. */
+
+    ~ThreadPool(){
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (size_t i = 0; i < threads.size(); i++){
+            threads[i].join();
+        }
+    }
+
+    int Size(){
+        return threads.size();
+    }
+
+    void Submit(const function<void()>& task){
+        {
+            lock_guard<mutex> guard(lock);
+            tasks.push_back(task);
+        }
+        ready.notify_one();
+    }
+};
+
+/* Idle Systems kept by size, so a job reuses built topologies instead of allocating. */
+
+class SystemCache {
+private:
+    map<int, vector<System*> > idle;
+    mutex lock;
+    long hits;
+    long misses;
+
+public:
+    SystemCache() : hits(0), misses(0){}
+
+    ~SystemCache(){
+        for (map<int, vector<System*> >::iterator it = idle.begin(); it != idle.end(); ++it){
+            for (size_t i = 0; i < it->second.size(); i++){
+                delete it->second[i];
+            }
+        }
+    }
+
+    System* Acquire(int size){
+        {
+            lock_guard<mutex> guard(lock);
+            vector<System*>& free = idle[size];
+
+            if (!free.empty()){
+                System* graph = free.back();
+                free.pop_back();
+                hits++;
+                return graph;
+            }
+            misses++;
+        }
+        return new System(size);
+    }
+
+    void Release(System* graph){
+        lock_guard<mutex> guard(lock);
+        idle[graph->Size()].push_back(graph);
+    }
+
+    /* Builds count Systems of the given size ahead of the first job that needs them. */
+
+    void Warm(int size, int count){
+        vector<System*> built;
+
+        for (int i = 0; i < count; i++){
+            built.push_back(new System(size));
+        }
+        lock_guard<mutex> guard(lock);
+        idle[size].insert(idle[size].end(), built.begin(), built.end());
+    }
+
+    string Stats(){
+        lock_guard<mutex> guard(lock);
+        stringstream line;
+
+        line << "cache hits " << hits << " misses " << misses << " sizes";
+        for (map<int, vector<System*> >::iterator it = idle.begin(); it != idle.end(); ++it){
+            line << ' ' << it->first << ':' << it->second.size();
+        }
+        return line.str();
+    }
+};
+
+/* Writes a whole line to a socket. Returns false when the peer has gone away. */
+
+bool SendLine(int fd, const string& line){
+    string data = line + '\n';
+    size_t sent = 0;
+
+    while (sent < data.size()){
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0){
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+/* Reads one '\n' terminated line from a socket, buffering the remainder.
+   Returns false at end of stream. */
+
+bool ReceiveLine(int fd, string& buffer, string& line){
+    size_t end;
+
+    while ((end = buffer.find('\n')) == string::npos){
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+
+        if (n <= 0){
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return true;
+}
+
+/* Long-lived simulation service on a Unix-domain socket.
+   Keeps the thread pool and built Systems warm between jobs and streams each chunk's
+   totals back as soon as it finishes.
+
+   PROTOCOL (one request per line):
+        run <size> <faults> <trials> [budget] [seed]   -> chunk <k> <stabilized> <steps> ...
+                                                          done <size> <faults> <trials> <stabilized> <mean_steps> <microseconds>
+        warm <size> [count]                            -> ok
+        stats                                          -> ok <cache statistics>
+        shutdown                                       -> ok, then the server exits */
+
+class Server {
+private:
+    struct Result {
+        int chunk;
+        TrialTotals totals;
+    };
+
+    string path;
+    int listener;
+    ThreadPool pool;
+    SystemCache cache;
+    atomic<bool> running;
+    atomic<int> connections;
+    int chunkTrials;
+    int maxSize;                    // Largest System a request may ask for
+    mutex clientLock;
+    vector<int> clients;            // Connected sockets, woken on shutdown
+
+    /* Splits a run request into chunks on the pool and streams their results. */
+
+    void RunJob(int client, istringstream& request){
+        int size = 0, faults = -1, trials = 0;
+        long budget = 1000000;
+        uint64_t seed = rand();
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+
+        request >> size >> faults >> trials;
+        if (!(request >> budget)){
+            budget = 1000000;
+        }
+        request >> seed;
+        if ((size < 2) || (size > maxSize) || (faults < 0) || (trials < 1) || (budget < 1)){
+            SendLine(client, "error expected run <2 <= size <= " + to_string(maxSize) +
+                             "> <faults >= 0> <trials >= 1> [budget >= 1] [seed]");
+            return;
+        }
+
+        int chunks = (trials + chunkTrials - 1) / chunkTrials;
+        deque<Result> finished;
+        mutex lock;
+        condition_variable ready;
+
+        for (int k = 0; k < chunks; k++){
+            int count = min(chunkTrials, trials - k * chunkTrials);
+
+            pool.Submit([=, &finished, &lock, &ready]{
+                System* graph = cache.Acquire(size);
+                Result result;
+
+                graph->Seed(MixSeed(seed, ((uint64_t)size << 32) | (uint32_t)faults, k));
+                result.chunk = k;
+                result.totals = SystemTrials(*graph, faults, count, budget);
+                cache.Release(graph);
+
+                // Notified under the lock: RunJob cannot take the last result and destroy
+                // lock and ready before this task is done with them.
+                lock_guard<mutex> guard(lock);
+                finished.push_back(result);
+                ready.notify_one();
+            });
+        }
+
+        TrialTotals totals = { 0, 0 };
+        bool connected = true;
+
+        for (int received = 0; received < chunks; received++){
+            Result result;
+            {
+                unique_lock<mutex> guard(lock);
+                ready.wait(guard, [&finished]{ return !finished.empty(); });
+                result = finished.front();
+                finished.pop_front();
+            }
+            totals.steps += result.totals.steps;
+            totals.stabilized += result.totals.stabilized;
+            if (connected){
+                stringstream line;
+                line << "chunk " << result.chunk << ' ' << result.totals.stabilized << ' ' << result.totals.steps;
+                connected = SendLine(client, line.str());
+            }
+        }
+
+        stringstream line;
+        line << "done " << size << ' ' << faults << ' ' << trials << ' ' << totals.stabilized << ' '
+             << (totals.stabilized ? (double)totals.steps / totals.stabilized : 0) << ' '
+             << (boost::posix_time::microsec_clock::local_time() - start).total_microseconds();
+        SendLine(client, line.str());
+    }
+
+    /* Handles the requests of one client connection. */
+
+    void Serve(int client){
+        string buffer, line;
+
+        while (running && ReceiveLine(client, buffer, line)){
+            istringstream request(line);
+            string command;
+
+            request >> command;
+            if (command == "run"){
+                RunJob(client, request);
+            }
+            else if (command == "warm"){
+                int size = 0, count = pool.Size();
+
+                request >> size >> count;
+                if ((size < 2) || (size > maxSize) || (count < 0) || (count > pool.Size())){
+                    SendLine(client, "error expected warm <2 <= size <= " + to_string(maxSize) + "> [count <= " +
+                                     to_string(pool.Size()) + "]");
+                }
+                else {
+                    cache.Warm(size, count);
+                    SendLine(client, "ok");
+                }
+            }
+            else if (command == "stats"){
+                SendLine(client, "ok " + cache.Stats());
+            }
+            else if (command == "shutdown"){
+                SendLine(client, "ok");
+                running = false;
+                shutdown(listener, SHUT_RDWR);
+
+                // Idle clients wait in recv; ending their input lets them finish, while a
+                // client inside RunJob still receives the rest of its results.
+                lock_guard<mutex> guard(clientLock);
+                for (size_t c = 0; c < clients.size(); c++){
+                    shutdown(clients[c], SHUT_RD);
+                }
+            }
+            else if (!command.empty()){
+                SendLine(client, "error unknown command " + command);
+            }
+        }
+        {
+            lock_guard<mutex> guard(clientLock);
+            clients.erase(find(clients.begin(), clients.end(), client));
+        }
+        close(client);
+        connections--;
+    }
+
+public:
+    Server(const string& _path, int threads, int _chunkTrials, int _maxSize)
+        : path(_path), listener(-1), pool(threads), running(true), connections(0), chunkTrials(_chunkTrials),
+          maxSize(_maxSize){}
+
+    /* Accepts clients until a shutdown request. Returns the process exit status. */
+
+    int Run(){
+        sockaddr_un address;
+
+        if (path.size() >= sizeof(address.sun_path)){
+            cerr << "serve: socket path too long\n";
+            return 1;
+        }
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if ((listener < 0) || (bind(listener, (sockaddr*)&address, sizeof(address)) != 0) || (listen(listener, 16) != 0)){
+            cerr << "serve: cannot listen on " << path << ": " << strerror(errno) << '\n';
+            return 1;
+        }
+        cerr << "serving on " << path << " with " << pool.Size() << " threads\n";
+
+        while (running){
+            int client = accept(listener, NULL, NULL);
+
+            if (client < 0){
+                if (errno == EINTR){
+                    continue;
+                }
+                break;
+            }
+            connections++;
+            {
+                lock_guard<mutex> guard(clientLock);
+                clients.push_back(client);
+                if (!running){
+                    shutdown(client, SHUT_RD);  // Accepted after a shutdown request
+                }
+            }
+            thread(&Server::Serve, this, client).detach();
+        }
+
+        // Let connected clients finish their current request before the pool goes away.
+        while (connections > 0){
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        close(listener);
+        unlink(path.c_str());
+        return 0;
+    }
+};
+
+/* Service mode: runs a Server on --socket until a client sends shutdown. */
+
+int RunServer(const Options& options){
+    int cores = max(1, (int)thread::hardware_concurrency());
+    int threads = options.Get("threads", (long)cores);
+    int chunk = options.Get("chunk", 64L);
+    long maxSize = options.Get("max-size", 1L << 20);
+
+    if ((threads < 1) || (chunk < 1) || (maxSize < 2) || (maxSize > INT_MAX)){
+        cerr << "serve: expected threads and chunk >= 1, 2 <= max-size <= " << INT_MAX << "\n";
+        return 1;
+    }
+
+    Server server(options.Get("socket", "/tmp/stabilization.sock"), threads, chunk, maxSize);
+    return server.Run();
+}
+
+/* Client mode: sends one request to a Server and prints the streamed reply. */
+
+int RunClient(const string& path, const string& request){
+    sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    string buffer, line;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    if ((fd < 0) || (connect(fd, (sockaddr*)&address, sizeof(address)) != 0)){
+        cerr << "submit: cannot connect to " << path << ": " << strerror(errno) << '\n';
+        return 1;
+    }
+
+    SendLine(fd, request);
+    while (ReceiveLine(fd, buffer, line)){
+        cout << line << '\n';
+        if ((line.compare(0, 4, "done") == 0) || (line.compare(0, 2, "ok") == 0) || (line.compare(0, 5, "error") == 0)){
+            break;
+        }
+    }
+    close(fd);
+    return (line.compare(0, 5, "error") == 0) ? 1 : 0;
+}
+
+/* Persistent store of built topologies.
+   Each key (the generator parameters, e.g. "mesh-1000x1000") maps to one binary file that
+   is mapped read-only on load, so later runs and concurrent processes share the page cache
+   with no parsing.
+
+   FILE FORMAT (native endianness, every section 64 byte aligned):
+        CacheHeader
+        CacheSection[sectionCount]      "offset" (int64, nodes + 1), "adjacency" (int32, arcs),
+                                        then any named int32 sections of the graph
+        section data */
+
+class TopologyCache {
+private:
+    struct CacheHeader {
+        char magic[8];          // "STABTOPO"
+        uint32_t version;
+        uint32_t sectionCount;
+        int64_t nodes;
+        int64_t arcs;
+    };
+
+    struct CacheSection {
+        char name[16];
+        uint64_t offset;        // Byte offset from the start of the file
+        uint64_t count;         // Number of elements
+        uint32_t elementSize;
+        uint32_t reserved;
+    };
+
+    static const uint32_t VERSION = 1;
+
+    string directory;
+
+    static uint64_t Align(uint64_t x){
+        return (x + 63) & ~(uint64_t)63;
+    }
+
+public:
+    TopologyCache(const string& _directory) : directory(_directory){}
+
+    /* File name for a key: the key with unsafe characters replaced. */
+
+    string Path(const string& key) const {
+        string name = key;
+
+        for (size_t i = 0; i < name.size(); i++){
+            if (!isalnum((unsigned char)name[i]) && (name[i] != '-') && (name[i] != '.') && (name[i] != '_')){
+                name[i] = '_';
+            }
+        }
+        return directory + "/" + name + ".topo";
+    }
+
+    /* Maps the cached topology for key. Returns NULL when absent or invalid: every section
+       must lie in the file and have the length the header implies, and the CSR arrays must
+       describe a graph on the header's nodes, so a stale or corrupt file is rebuilt instead
+       of being read out of bounds. */
+
+    Graph* Load(const string& key) const {
+        int fd = open(Path(key).c_str(), O_RDONLY);
+        struct stat info;
+
+        if (fd < 0){
+            return NULL;
+        }
+        if ((fstat(fd, &info) != 0) || ((size_t)info.st_size < sizeof(CacheHeader))){
+            close(fd);
+            return NULL;
+        }
+
+        size_t size = info.st_size;
+        void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED){
+            return NULL;
+        }
+
+        const char* base = (const char*)data;
+        const CacheHeader* header = (const CacheHeader*)base;
+        const CacheSection* table = (const CacheSection*)(base + sizeof(CacheHeader));
+        Graph* graph = new Graph();
+
+        graph->mapping = data;
+        graph->mappingSize = size;
+        if ((memcmp(header->magic, "STABTOPO", 8) != 0) || (header->version != VERSION) ||
+            (sizeof(CacheHeader) + (uint64_t)header->sectionCount * sizeof(CacheSection) > size) ||
+            (header->nodes < 0) || (header->nodes >= INT_MAX) || (header->arcs < 0) || (header->arcs > INT_MAX)){
+            delete graph;
+            return NULL;
+        }
+        for (uint32_t s = 0; s < header->sectionCount; s++){
+            const CacheSection& section = table[s];
+            string name(section.name, strnlen(section.name, sizeof(section.name)));
+            uint64_t element = (name == "offset") ? sizeof(int64_t) : sizeof(int);
+            uint64_t expected = (name == "offset") ? header->nodes + 1 : (name == "adjacency") ? header->arcs : section.count;
+
+            if ((section.elementSize != element) || (section.count != expected) || (section.offset % element != 0) ||
+                (section.offset > size) || (section.count > (size - section.offset) / element)){
+                delete graph;
+                return NULL;
+            }
+            if (name == "offset"){
+                graph->offset = (const int64_t*)(base + section.offset);
+            }
+            else if (name == "adjacency"){
+                graph->adjacency = (const int*)(base + section.offset);
+            }
+            else {
+                graph->sections[name] = make_pair((const int*)(base + section.offset), (int64_t)section.count);
+            }
+        }
+        graph->nodes = header->nodes;
+        graph->arcs = header->arcs;
+        if ((graph->offset == NULL) || ((graph->adjacency == NULL) && (graph->arcs > 0)) || (graph->offset[0] != 0) ||
+            (graph->offset[graph->nodes] != graph->arcs)){
+            delete graph;
+            return NULL;
+        }
+        // One pass over the arrays, so that no adjacency run or neighbor points outside them.
+        for (int v = 0; v < graph->nodes; v++){
+            if (graph->offset[v + 1] < graph->offset[v]){
+                delete graph;
+                return NULL;
+            }
+        }
+        for (int64_t a = 0; a < graph->arcs; a++){
+            if ((graph->adjacency[a] < 0) || (graph->adjacency[a] >= graph->nodes)){
+                delete graph;
+                return NULL;
+            }
+        }
+        return graph;
+    }
+
+    /* Writes graph (and its sections) under key.
+       The file is written aside and renamed, so readers never see a partial file. */
+
+    bool Store(const string& key, const Graph& graph) const {
+        vector<string> names = graph.SectionNames();
+        vector<CacheSection> table(2 + names.size());
+        vector<const void*> payload;
+        CacheHeader header;
+        uint64_t position;
+
+        mkdir(directory.c_str(), 0755);
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "STABTOPO", 8);
+        header.version = VERSION;
+        header.sectionCount = table.size();
+        header.nodes = graph.Size();
+        header.arcs = graph.Arcs();
+
+        memset(&table[0], 0, table.size() * sizeof(CacheSection));
+        strcpy(table[0].name, "offset");
+        table[0].count = graph.Size() + 1;
+        table[0].elementSize = sizeof(int64_t);
+        payload.push_back(graph.Offsets());
+        strcpy(table[1].name, "adjacency");
+        table[1].count = graph.Arcs();
+        table[1].elementSize = sizeof(int);
+        payload.push_back(graph.Adjacency());
+        for (size_t s = 0; s < names.size(); s++){
+            int64_t length = 0;
+
+            payload.push_back(graph.Section(names[s], &length));
+            strncpy(table[2 + s].name, names[s].c_str(), sizeof(table[2 + s].name) - 1);
+            table[2 + s].count = length;
+            table[2 + s].elementSize = sizeof(int);
+        }
+
+        position = Align(sizeof(CacheHeader) + table.size() * sizeof(CacheSection));
+        for (size_t s = 0; s < table.size(); s++){
+            table[s].offset = position;
+            position = Align(position + table[s].count * table[s].elementSize);
+        }
+
+        string path = Path(key);
+        stringstream temporary;
+        temporary << path << ".tmp" << getpid();
+        FILE* file = fopen(temporary.str().c_str(), "wb");
+        bool ok = (file != NULL);
+
+        if (ok){
+            ok = (fwrite(&header, sizeof(header), 1, file) == 1) &&
+                 (fwrite(&table[0], sizeof(CacheSection), table.size(), file) == table.size());
+            for (size_t s = 0; ok && (s < table.size()); s++){
+                size_t bytes = table[s].count * table[s].elementSize;
+
+                ok = (fseek(file, table[s].offset, SEEK_SET) == 0) &&
+                     ((bytes == 0) || (fwrite(payload[s], 1, bytes, file) == bytes));
+            }
+            ok = (fclose(file) == 0) && ok;
+        }
+        if (ok){
+            ok = (rename(temporary.str().c_str(), path.c_str()) == 0);
+        }
+        if (!ok){
+            unlink(temporary.str().c_str());
+        }
+        return ok;
+    }
+
+    /* Stores a copy of the cached graph for key with one more named section. */
+
+    bool AddSection(const string& key, const Graph& graph, const string& name, const vector<int>& data) const {
+        Graph copy;
+        vector<int64_t> offsets(graph.Offsets(), graph.Offsets() + graph.Size() + 1);
+        vector<int> adjacency(graph.Adjacency(), graph.Adjacency() + graph.Arcs());
+        vector<string> names = graph.SectionNames();
+
+        copy.Assign(offsets, adjacency);
+        for (size_t s = 0; s < names.size(); s++){
+            int64_t length = 0;
+            const int* section = graph.Section(names[s], &length);
+
+            copy.SetSection(names[s], vector<int>(section, section + length));
+        }
+        copy.SetSection(name, data);
+        return Store(key, copy);
+    }
+};
+
+/* Topology parameters from the command line:
+       --topology list|ring|tree --size n
+       --topology mesh --rows r --cols c
+       --topology ws --size n [--k 6] [--beta 0.1] [--seed s]
+       --topology ba --size n [--m 4] [--seed s]
+       --topology config --size n [--gamma 2.5] [--min-degree 2] [--max-degree 1000] [--seed s]
+   Generated topologies are built with --threads threads; the result does not depend on it. */
+
+string TopologyKey(const Options& options){
+    string type = options.Get("topology", "list");
+    stringstream key;
+
+    if (type == "mesh"){
+        key << "mesh-" << options.Get("rows", 32L) << 'x' << options.Get("cols", 32L);
+    }
+    else {
+        key << type << '-' << options.Get("size", 1024L);
+    }
+    if (type == "ws"){
+        key << "-k" << options.Get("k", 6L) << "-b" << options.Get("beta", "0.1");
+    }
+    else if (type == "ba"){
+        key << "-m" << options.Get("m", 4L);
+    }
+    else if (type == "config"){
+        key << "-g" << options.Get("gamma", "2.5") << "-d" << options.Get("min-degree", 2L) << '-' << options.Get("max-degree", 1000L);
+    }
+    if ((type == "ws") || (type == "ba") || (type == "config")){
+        key << "-s" << options.Get("seed", 1L);
+    }
+    return key.str();
+}
+
+/* Builds the topology described by the options. Returns NULL for unknown types. */
+
+Graph* BuildTopology(const Options& options){
+    string type = options.Get("topology", "list");
+    int size = options.Get("size", 1024L);
+    uint64_t seed = options.Get("seed", 1L);
+    int threads = max(1L, options.Get("threads", (long)thread::hardware_concurrency()));
+
+    if (type == "mesh"){
+        int rows = options.Get("rows", 32L);
+        int cols = options.Get("cols", 32L);
+        return ((rows > 0) && (cols > 0)) ? Graph::Mesh(rows, cols) : NULL;
+    }
+    if (size < 2){
+        return NULL;
+    }
+    if (type == "list"){
+        return Graph::List(size);
+    }
+    if (type == "ring"){
+        return Graph::Ring(size);
+    }
+    if (type == "tree"){
+        return Graph::Tree(size);
+    }
+    if (type == "ws"){
+        int k = options.Get("k", 6L);
+        double beta = atof(options.Get("beta", "0.1").c_str());
+        return ((k >= 2) && (k < size) && (beta >= 0) && (beta <= 1)) ? Graph::WattsStrogatz(size, k, beta, seed, threads) : NULL;
+    }
+    if (type == "ba"){
+        int m = options.Get("m", 4L);
+        return (m >= 1) ? Graph::BarabasiAlbert(size, m, seed, threads) : NULL;
+    }
+    if (type == "config"){
+        double gamma = atof(options.Get("gamma", "2.5").c_str());
+        int low = options.Get("min-degree", 2L);
+        int high = options.Get("max-degree", 1000L);
+        return ((gamma > 1) && (low >= 1) && (high >= low)) ? Graph::Configuration(size, gamma, low, high, seed, threads) : NULL;
+    }
+    return NULL;
+}
+
+/* Returns the topology described by the options, mapped from the cache when possible.
+   The cache directory is --cache, else $STABILIZATION_CACHE; without either nothing is cached. */
+
+Graph* LoadTopology(const Options& options){
+    const char* environment = getenv("STABILIZATION_CACHE");
+    string directory = options.Get("cache", environment ? string(environment) : string());
+    string key = TopologyKey(options);
+    Graph* graph;
+
+    if (directory.empty()){
+        return BuildTopology(options);
+    }
+
+    TopologyCache cache(directory);
+    if ((graph = cache.Load(key)) != NULL){
+        return graph;
+    }
+    if ((graph = BuildTopology(options)) == NULL){
+        return NULL;
+    }
+    if (cache.Store(key, *graph)){
+        Graph* mapped = cache.Load(key);
+
+        if (mapped != NULL){
+            delete graph;
+            graph = mapped;
+        }
+    }
+    return graph;
+}
+
+/* Structural metrics of a topology, to correlate convergence with structure.
+   Written to results files as a fixed size TOPOLOGY record. */
+
+struct TopologyMetrics {
+    int64_t nodes;
+    int64_t edges;
+    int64_t minDegree;
+    int64_t maxDegree;
+    double meanDegree;
+    double degreeDeviation;
+    int64_t degreeHistogram[32];    // Nodes of degree in [2^b, 2^(b+1)); bin 0 also counts degree 0
+    double clustering;              // Mean local clustering coefficient
+    int64_t clusteringNodes;        // Nodes it was measured on, all of them unless sampled
+    int64_t diameter;               // Lower bound, the greatest eccentricity found
+    double eccentricity;            // Mean eccentricity of uniformly drawn nodes, as fault sites are
+    int64_t sources;                // Uniformly drawn BFS sources
+
+private:
+    /* Breadth first search from up to 64 sources at once: bit s of seen[v] is set when
+       source s reaches v, so a level costs one pass over the frontier's arcs for all sources.
+       Frontiers are expanded in parallel when large. Sets the eccentricity of each source
+       within its component and the lowest numbered node at that distance. */
+
+    static void Search(const Graph& graph, int threads, const vector<int>& sources,
+                       vector<int64_t>& eccentricity, vector<int>& farthest){
+        int n = graph.Size();
+        vector< atomic<uint64_t> > seen(n), next(n);
+        vector< pair<int, uint64_t> > frontier;
+        vector< vector<int> > reached(max(1, threads));
+
+        ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+            for (int64_t v = begin; v < end; v++){
+                seen[v].store(0, memory_order_relaxed);
+                next[v].store(0, memory_order_relaxed);
+            }
+        });
+        eccentricity.assign(sources.size(), 0);
+        farthest.assign(sources.begin(), sources.end());
+        for (size_t s = 0; s < sources.size(); s++){
+            if (seen[sources[s]].fetch_or((uint64_t)1 << s) == 0){
+                frontier.push_back(make_pair(sources[s], (uint64_t)0));
+            }
+        }
+        for (size_t f = 0; f < frontier.size(); f++){
+            frontier[f].second = seen[frontier[f].first].load();
+        }
+
+        for (int64_t level = 1; !frontier.empty(); level++){
+            auto expand = [&](int t, int64_t begin, int64_t end){
+                for (int64_t f = begin; f < end; f++){
+                    uint64_t mask = frontier[f].second;
+
+                    for (const int* j = graph.Begin(frontier[f].first); j != graph.End(frontier[f].first); j++){
+                        uint64_t fresh = mask & ~seen[*j].load(memory_order_relaxed);
+
+                        if (fresh != 0){
+                            fresh &= ~seen[*j].fetch_or(fresh, memory_order_relaxed);
+                            if ((fresh != 0) && (next[*j].fetch_or(fresh, memory_order_relaxed) == 0)){
+                                reached[t].push_back(*j);
+                            }
+                        }
+                    }
+                }
+            };
+            if ((threads > 1) && (frontier.size() >= 4096)){
+                ParallelFor(threads, frontier.size(), expand);
+            }
+            else {
+                expand(0, 0, frontier.size());
+            }
+
+            frontier.clear();
+            for (size_t t = 0; t < reached.size(); t++){
+                for (size_t k = 0; k < reached[t].size(); k++){
+                    int v = reached[t][k];
+                    uint64_t mask = next[v].exchange(0, memory_order_relaxed);
+
+                    frontier.push_back(make_pair(v, mask));
+                    for (; mask != 0; mask &= mask - 1){
+                        int s = __builtin_ctzll(mask);
+
+                        if ((level > eccentricity[s]) || (v < farthest[s])){
+                            eccentricity[s] = level;
+                            farthest[s] = v;
+                        }
+                    }
+                }
+                reached[t].clear();
+            }
+        }
+    }
+
+    /* Local clustering coefficient of node v: the share of its neighbor pairs that are
+       adjacent. Hubs are estimated from random neighbor pairs. */
+
+    static double Clustering(const Graph& graph, int v, Random& random){
+        const int* begin = graph.Begin(v);
+        int64_t degree = graph.Degree(v), links = 0;
+
+        if (degree < 2){
+            return 0;
+        }
+        if (degree > 256){
+            for (int k = 0; k < 4096; k++){
+                int a = begin[random.Below(degree)], b = begin[random.Below(degree)];
+
+                links += (a != b) && binary_search(graph.Begin(a), graph.End(a), b);
+            }
+            return links / 4096.0 * degree / (degree - 1);
+        }
+        for (const int* u = begin; u != graph.End(v); u++){
+            const int* a = begin;
+            const int* b = graph.Begin(*u);
+
+            while ((a != graph.End(v)) && (b != graph.End(*u))){
+                if (*a < *b){
+                    a++;
+                }
+                else if (*b < *a){
+                    b++;
+                }
+                else {
+                    links += (*a != *u);
+                    a++;
+                    b++;
+                }
+            }
+        }
+        return (double)links / (degree * (degree - 1));
+    }
+
+public:
+    /* Computes the metrics with the given threads. Clustering is averaged over every node
+       or over samples uniformly drawn ones if fewer; eccentricity and the diameter bound come
+       from sources uniformly drawn nodes (every node when there are no more) followed by a
+       second search from the farthest nodes they found. */
+
+    static TopologyMetrics Of(const Graph& graph, int threads, int samples, int sources, uint64_t seed){
+        TopologyMetrics metrics;
+        int n = graph.Size();
+        vector<TopologyMetrics> partial(max(1, threads));
+        vector<double> clustering(max(1, threads), 0);
+        bool sampled = (n > samples);
+
+        memset(&metrics, 0, sizeof(metrics));
+        metrics.nodes = n;
+        metrics.edges = graph.Arcs() / 2;
+        metrics.minDegree = (n > 0) ? graph.Degree(0) : 0;
+        metrics.clusteringNodes = sampled ? samples : n;
+        ParallelFor(threads, max(n, (int)metrics.clusteringNodes), [&](int t, int64_t begin, int64_t end){
+            TopologyMetrics& own = partial[t];
+
+            memset(&own, 0, sizeof(own));
+            own.minDegree = metrics.minDegree;
+            for (int64_t v = begin; v < min(end, (int64_t)n); v++){
+                int64_t degree = graph.Degree(v);
+
+                own.minDegree = min(own.minDegree, degree);
+                own.maxDegree = max(own.maxDegree, degree);
+                own.meanDegree += degree;
+                own.degreeDeviation += (double)degree * degree;
+                own.degreeHistogram[(degree > 1) ? 63 - __builtin_clzll(degree) : 0]++;
+            }
+            for (int64_t k = begin; k < min(end, metrics.clusteringNodes); k++){
+                Random pick(MixSeed(seed, k, 3));
+
+                clustering[t] += Clustering(graph, sampled ? pick.Below(n) : k, pick);
+            }
+        });
+        for (size_t t = 0; t < partial.size(); t++){
+            metrics.minDegree = min(metrics.minDegree, partial[t].minDegree);
+            metrics.maxDegree = max(metrics.maxDegree, partial[t].maxDegree);
+            metrics.meanDegree += partial[t].meanDegree;
+            metrics.degreeDeviation += partial[t].degreeDeviation;
+            for (int b = 0; b < 32; b++){
+                metrics.degreeHistogram[b] += partial[t].degreeHistogram[b];
+            }
+            metrics.clustering += clustering[t];
+        }
+        if (n == 0){
+            return metrics;
+        }
+        metrics.meanDegree /= n;
+        metrics.degreeDeviation = sqrt(max(0.0, metrics.degreeDeviation / n - metrics.meanDegree * metrics.meanDegree));
+        metrics.clustering /= max((int64_t)1, metrics.clusteringNodes);
+
+        // Uniform sources in batches of 64, then one batch from the farthest nodes found.
+        vector<int> far;
+        vector<int64_t> eccentricity;
+        vector<int> batch, farthest;
+        double sum = 0;
+
+        metrics.sources = min(sources, n);
+        for (int64_t s = 0; s < metrics.sources; s += 64){
+            Random pick(MixSeed(seed, s, 4));
+
+            batch.clear();
+            for (int64_t k = s; k < min(s + 64, metrics.sources); k++){
+                batch.push_back((metrics.sources == n) ? k : pick.Below(n));
+            }
+            Search(graph, threads, batch, eccentricity, farthest);
+            for (size_t k = 0; k < batch.size(); k++){
+                sum += eccentricity[k];
+                metrics.diameter = max(metrics.diameter, eccentricity[k]);
+                if (far.size() < 64){
+                    far.push_back(farthest[k]);
+                }
+            }
+        }
+        metrics.eccentricity = sum / max((int64_t)1, metrics.sources);
+        if (metrics.sources < n){
+            sort(far.begin(), far.end());
+            far.erase(unique(far.begin(), far.end()), far.end());
+            Search(graph, threads, far, eccentricity, farthest);
+            for (size_t k = 0; k < far.size(); k++){
+                metrics.diameter = max(metrics.diameter, eccentricity[k]);
+            }
+        }
+        return metrics;
+    }
+
+    void Print(ostream& out) const {
+        out << "degree: min " << minDegree << ", mean " << meanDegree << " (sd " << degreeDeviation << "), max "
+            << maxDegree << "; nodes per degree range";
+        for (int b = 0; b < 32; b++){
+            if (degreeHistogram[b] != 0){
+                out << ' ' << ((b == 0) ? 0 : ((int64_t)1 << b)) << '-' << ((int64_t)2 << b) - 1 << ':' << degreeHistogram[b];
+            }
+        }
+        out << "\nclustering: " << clustering << " over " << clusteringNodes << " nodes\n";
+        out << "diameter: " << ((sources < nodes) ? "at least " : "") << diameter << ", fault site eccentricity "
+            << eccentricity << " over " << sources << " sources\n";
+    }
+};
+
+/* Topology mode: builds or maps a topology and reports its size and load time and
+   its structural metrics. */
+
+int RunTopology(const Options& options){
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+    Graph* graph = LoadTopology(options);
+    boost::posix_time::ptime stop = boost::posix_time::microsec_clock::local_time();
+
+    if (graph == NULL){
+        cerr << "topology: cannot build " << TopologyKey(options) << '\n';
+        return 1;
+    }
+
+    vector<string> names = graph->SectionNames();
+    cout << TopologyKey(options) << ": " << graph->Size() << " nodes, " << graph->Arcs() / 2 << " edges, "
+         << (graph->Mapped() ? "mapped" : "built") << " in " << (stop - start).total_microseconds() << " microseconds\n";
+    for (size_t s = 0; s < names.size(); s++){
+        int64_t length = 0;
+        graph->Section(names[s], &length);
+        cout << "section " << names[s] << ": " << length << " entries\n";
+    }
+    TopologyMetrics::Of(*graph, options.Get("threads", (long)max(1, (int)thread::hardware_concurrency())),
+                        options.Get("metric-samples", 10000L), options.Get("metric-sources", 64L), 1).Print(cout);
+    delete graph;
+    return 0;
+}
+
+/* Result of partitioning a topology. */
+
+struct Partition {
+    vector<int> part;       // Part of each node
+    int64_t cut;            // Edges whose endpoints lie in different parts
+    double imbalance;       // Largest part weight over the average part weight
+    int levels;             // Graphs in the coarsening hierarchy
+};
+
+/* Multilevel k-way graph partitioner.
+   (1) Coarsening: nodes are paired by parallel heavy-edge matching and contracted until
+       the graph is small.
+   (2) Initial partition: the coarsest graph is cut into contiguous breadth first chunks
+       of equal weight.
+   (3) Uncoarsening: the partition is projected back level by level and refined with
+       parallel boundary moves that reduce the cut without exceeding the balance limit. */
+
+class Partitioner {
+private:
+    /* One graph of the hierarchy. Level 0 views the input Graph with unit weights. */
+
+    struct Level {
+        int nodes;
+        const int64_t* offset;
+        const int* adjacency;
+        const int* weight;              // Edge weights, NULL for unit weights
+        const int* nodeWeight;          // Node weights, NULL for unit weights
+        vector<int64_t> ownedOffset;
+        vector<int> ownedAdjacency;
+        vector<int> ownedWeight;
+        vector<int> ownedNodeWeight;
+        vector<int> coarse;             // Node of the next coarser level each node maps to
+
+        int EdgeWeight(int64_t e) const {
+            return (weight == NULL) ? 1 : weight[e];
+        }
+
+        int NodeWeight(int v) const {
+            return (nodeWeight == NULL) ? 1 : nodeWeight[v];
+        }
+    };
+
+    int parts;
+    int threads;
+    double tolerance;               // Allowed part weight over the average, e.g. 1.03
+    uint64_t seed;
+    vector<Level*> levels;
+
+    /* Tie breaker for equally heavy edges, symmetric in its arguments. */
+
+    uint64_t EdgeHash(int a, int b) const {
+        return MixSeed(seed, min(a, b), max(a, b));
+    }
+
+    /* Pairs nodes of level by heavy-edge matching and builds the next coarser level.
+       Returns NULL when matching no longer shrinks the graph usefully. */
+
+    Level* Coarsen(Level& level, int64_t maxNodeWeight){
+        int n = level.nodes;
+        vector<int> match(n, -1);
+        vector<int> proposal(n);
+
+        // A few rounds of mutual proposals: each unmatched node proposes to its heaviest
+        // unmatched neighbor and pairs that proposed to each other are matched.
+        for (int round = 0; round < 3; round++){
+            ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+                for (int v = begin; v < end; v++){
+                    int best = -1, bestWeight = 0;
+                    uint64_t bestHash = 0;
+
+                    proposal[v] = -1;
+                    if (match[v] >= 0){
+                        continue;
+                    }
+                    for (int64_t e = level.offset[v]; e < level.offset[v + 1]; e++){
+                        int u = level.adjacency[e];
+                        int w = level.EdgeWeight(e);
+
+                        if ((match[u] >= 0) || (level.NodeWeight(v) + level.NodeWeight(u) > maxNodeWeight)){
+                            continue;
+                        }
+                        uint64_t hash = EdgeHash(u, v);
+                        if ((w > bestWeight) || ((w == bestWeight) && (hash > bestHash))){
+                            best = u;
+                            bestWeight = w;
+                            bestHash = hash;
+                        }
+                    }
+                    proposal[v] = best;
+                }
+            });
+            ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+                for (int v = begin; v < end; v++){
+                    if ((proposal[v] >= 0) && (proposal[proposal[v]] == v)){
+                        match[v] = proposal[v];
+                    }
+                }
+            });
+        }
+
+        // Unmatched nodes are carried over alone; the lower id of a pair names it.
+        vector<int> members;
+        level.coarse.resize(n);
+        for (int v = 0; v < n; v++){
+            if (match[v] < 0){
+                match[v] = v;
+            }
+            if (match[v] >= v){
+                level.coarse[v] = members.size();
+                members.push_back(v);
+            }
+        }
+        for (int v = 0; v < n; v++){
+            if (match[v] < v){
+                level.coarse[v] = level.coarse[match[v]];
+            }
+        }
+
+        int coarseNodes = members.size();
+        if (coarseNodes > n * 0.95){
+            return NULL;
+        }
+
+        // Contract each pair, merging parallel edges, in independent ranges of coarse nodes.
+        int chunks = max(1, threads);
+        vector< vector<int> > chunkAdjacency(chunks), chunkWeight(chunks);
+        vector<int64_t> degree(coarseNodes + 1, 0);
+        Level* next = new Level();
+
+        next->ownedNodeWeight.resize(coarseNodes);
+        ParallelFor(chunks, coarseNodes, [&](int t, int64_t begin, int64_t end){
+            vector<int> slot(coarseNodes, -1);
+            vector<int>& adjacency = chunkAdjacency[t];
+            vector<int>& weight = chunkWeight[t];
+
+            for (int c = begin; c < end; c++){
+                int v = members[c];
+                int pair[2] = { v, match[v] };
+                size_t first = adjacency.size();
+
+                next->ownedNodeWeight[c] = level.NodeWeight(v) + ((match[v] != v) ? level.NodeWeight(match[v]) : 0);
+                for (int k = 0; k < ((match[v] != v) ? 2 : 1); k++){
+                    for (int64_t e = level.offset[pair[k]]; e < level.offset[pair[k] + 1]; e++){
+                        int u = level.coarse[level.adjacency[e]];
+
+                        if (u == c){
+                            continue;
+                        }
+                        if ((slot[u] < (int)first) || (slot[u] >= (int)adjacency.size()) || (adjacency[slot[u]] != u)){
+                            slot[u] = adjacency.size();
+                            adjacency.push_back(u);
+                            weight.push_back(0);
+                        }
+                        weight[slot[u]] += level.EdgeWeight(e);
+                    }
+                }
+                degree[c + 1] = adjacency.size() - first;
+            }
+        });
+
+        next->nodes = coarseNodes;
+        for (int c = 0; c < coarseNodes; c++){
+            degree[c + 1] += degree[c];
+        }
+        next->ownedOffset.swap(degree);
+        for (int t = 0; t < chunks; t++){
+            next->ownedAdjacency.insert(next->ownedAdjacency.end(), chunkAdjacency[t].begin(), chunkAdjacency[t].end());
+            next->ownedWeight.insert(next->ownedWeight.end(), chunkWeight[t].begin(), chunkWeight[t].end());
+        }
+        next->offset = &next->ownedOffset[0];
+        next->adjacency = next->ownedAdjacency.empty() ? NULL : &next->ownedAdjacency[0];
+        next->weight = next->ownedWeight.empty() ? NULL : &next->ownedWeight[0];
+        next->nodeWeight = &next->ownedNodeWeight[0];
+        return next;
+    }
+
+    /* Cuts the breadth first order of level into parts chunks of equal weight. */
+
+    vector<int> InitialPartition(const Level& level, int64_t total){
+        int n = level.nodes;
+        vector<int> part(n, -1);
+        vector<int> order;
+        vector<char> seen(n, 0);
+
+        order.reserve(n);
+        for (int root = 0; root < n; root++){
+            if (seen[root]){
+                continue;
+            }
+            size_t head = order.size();
+            seen[root] = 1;
+            order.push_back(root);
+            while (head < order.size()){
+                int v = order[head++];
+
+                for (int64_t e = level.offset[v]; e < level.offset[v + 1]; e++){
+                    if (!seen[level.adjacency[e]]){
+                        seen[level.adjacency[e]] = 1;
+                        order.push_back(level.adjacency[e]);
+                    }
+                }
+            }
+        }
+
+        int64_t running = 0;
+        for (int i = 0; i < n; i++){
+            int v = order[i];
+
+            part[v] = (int)min((int64_t)parts - 1, running * parts / total);
+            running += level.NodeWeight(v);
+        }
+        return part;
+    }
+
+    /* Parallel boundary refinement.
+       Each pass moves nodes to the neighboring part they are most connected to when that
+       lowers the cut and keeps the target part under maxWeight. Alternate passes only allow
+       moves towards higher or lower part ids, which keeps concurrent moves from undoing
+       each other. Threads read the parts of neighbors other threads may be moving, so the
+       passes work on an atomic copy of part. */
+
+    void Refine(const Level& level, vector<int>& part, int64_t maxWeight){
+        int n = level.nodes;
+        vector< atomic<int64_t> > weight(parts);
+        vector< atomic<int> > current(n);
+
+        for (int p = 0; p < parts; p++){
+            weight[p] = 0;
+        }
+        for (int v = 0; v < n; v++){
+            current[v].store(part[v], memory_order_relaxed);
+            weight[part[v]] += level.NodeWeight(v);
+        }
+
+        for (int pass = 0; pass < 8; pass++){
+            atomic<int64_t> moved(0);
+            bool upward = (pass % 2 == 0);
+
+            ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+                vector<int64_t> connection(parts, 0);
+                vector<int> touched;
+
+                for (int v = begin; v < end; v++){
+                    int own = current[v].load(memory_order_relaxed);
+                    bool boundary = false;
+
+                    for (int64_t e = level.offset[v]; e < level.offset[v + 1]; e++){
+                        int p = current[level.adjacency[e]].load(memory_order_relaxed);
+
+                        if (connection[p] == 0){
+                            touched.push_back(p);
+                        }
+                        connection[p] += level.EdgeWeight(e);
+                        boundary |= (p != own);
+                    }
+
+                    int best = own;
+                    int64_t bestGain = 0;
+                    if (boundary){
+                        for (size_t i = 0; i < touched.size(); i++){
+                            int p = touched[i];
+                            int64_t gain = connection[p] - connection[own];
+
+                            if ((p != own) && ((p > own) == upward) && (gain > bestGain) &&
+                                (weight[p].load(memory_order_relaxed) + level.NodeWeight(v) <= maxWeight)){
+                                best = p;
+                                bestGain = gain;
+                            }
+                        }
+                    }
+                    for (size_t i = 0; i < touched.size(); i++){
+                        connection[touched[i]] = 0;
+                    }
+                    touched.clear();
+
+                    if (best != own){
+                        int w = level.NodeWeight(v);
+
+                        // Reserve room in the target part; another thread may have filled it.
+                        if (weight[best].fetch_add(w) + w <= maxWeight){
+                            weight[own] -= w;
+                            current[v].store(best, memory_order_relaxed);
+                            moved++;
+                        }
+                        else {
+                            weight[best] -= w;
+                        }
+                    }
+                }
+            });
+            if ((moved == 0) && !upward){
+                break;
+            }
+        }
+        for (int v = 0; v < n; v++){
+            part[v] = current[v].load(memory_order_relaxed);
+        }
+    }
+
+public:
+    Partitioner(int _parts, int _threads, double _tolerance, uint64_t _seed)
+        : parts(_parts), threads(_threads), tolerance(_tolerance), seed(_seed){}
+
+    ~Partitioner(){
+        for (size_t i = 0; i < levels.size(); i++){
+            delete levels[i];
+        }
+    }
+
+    /* Partitions graph into parts parts. */
+
+    Partition Run(const Graph& graph){
+        Partition result;
+        int n = graph.Size();
+        int64_t total = n;
+        int64_t maxWeight = (int64_t)(tolerance * total / parts) + 1;
+        Level* level = new Level();
+
+        level->nodes = n;
+        level->offset = graph.Offsets();
+        level->adjacency = graph.Adjacency();
+        level->weight = NULL;
+        level->nodeWeight = NULL;
+        levels.push_back(level);
+
+        // (1) Coarsening. Coarse nodes are capped so the initial partition can still balance.
+        int target = max(20 * parts, 200);
+        while (levels.back()->nodes > target){
+            Level* next = Coarsen(*levels.back(), max((int64_t)1, total / (4 * parts)));
+
+            if (next == NULL){
+                break;
+            }
+            levels.push_back(next);
+        }
+
+        // (2) Initial partition of the coarsest graph.
+        vector<int> part = InitialPartition(*levels.back(), total);
+        Refine(*levels.back(), part, maxWeight);
+
+        // (3) Project and refine back to the input graph.
+        for (int l = (int)levels.size() - 2; l >= 0; l--){
+            Level& fine = *levels[l];
+            vector<int> projected(fine.nodes);
+
+            ParallelFor(threads, fine.nodes, [&](int, int64_t begin, int64_t end){
+                for (int v = begin; v < end; v++){
+                    projected[v] = part[fine.coarse[v]];
+                }
+            });
+            part.swap(projected);
+            Refine(fine, part, maxWeight);
+        }
+
+        result.part.swap(part);
+        result.levels = levels.size();
+        Measure(graph, result);
+        return result;
+    }
+
+    /* Computes the cut and imbalance of result.part on graph. */
+
+    void Measure(const Graph& graph, Partition& result){
+        vector<int64_t> cuts(threads, 0);
+        vector<int64_t> weight(parts, 0);
+        const vector<int>& part = result.part;
+
+        ParallelFor(threads, graph.Size(), [&](int t, int64_t begin, int64_t end){
+            int64_t cut = 0;
+
+            for (int v = begin; v < end; v++){
+                for (const int* u = graph.Begin(v); u != graph.End(v); u++){
+                    cut += (part[*u] != part[v]);
+                }
+            }
+            cuts[t] = cut;
+        });
+        result.cut = 0;
+        for (int t = 0; t < threads; t++){
+            result.cut += cuts[t];
+        }
+        result.cut /= 2;
+        for (int v = 0; v < graph.Size(); v++){
+            weight[part[v]]++;
+        }
+        result.imbalance = (double)*max_element(weight.begin(), weight.end()) * parts / max(1, graph.Size());
+    }
+};
+
+/* Partition mode: partitions a topology, reports cut and imbalance and stores the
+   partition as section "part<k>" when the topology is cached. */
+
+int RunPartition(const Options& options){
+    int parts = options.Get("parts", 8L);
+    int cores = max(1, (int)thread::hardware_concurrency());
+    int threads = options.Get("threads", (long)cores);
+    string text = options.Get("tolerance", "1.03");
+    char* end = NULL;
+    double tolerance = strtod(text.c_str(), &end);
+    Graph* graph;
+
+    // A part can not be lighter than the average, so tolerances below 1 are rejected too.
+    if (text.empty() || (*end != '\0') || !(tolerance >= 1) || std::isinf(tolerance)){
+        cerr << "partition: expected a number >= 1 for --tolerance, e.g. 1.03\n";
+        return 1;
+    }
+    graph = LoadTopology(options);
+    if ((graph == NULL) || (parts < 1) || (threads < 1) || (parts > graph->Size())){
+        cerr << "partition: expected a valid topology and 1 <= parts <= nodes\n";
+        delete graph;
+        return 1;
+    }
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+    Partitioner partitioner(parts, threads, tolerance, options.Get("seed", 1L));
+    Partition partition = partitioner.Run(*graph);
+    boost::posix_time::ptime stop = boost::posix_time::microsec_clock::local_time();
+
+    cout << TopologyKey(options) << ": " << parts << " parts, cut " << partition.cut << " of " << graph->Arcs() / 2
+         << " edges, imbalance " << partition.imbalance << ", " << partition.levels << " levels, "
+         << (stop - start).total_microseconds() << " microseconds\n";
+
+    if (graph->Mapped()){
+        const char* environment = getenv("STABILIZATION_CACHE");
+        TopologyCache cache(options.Get("cache", environment ? string(environment) : string()));
+        stringstream name;
+
+        name << "part" << parts;
+        if (!cache.AddSection(TopologyKey(options), *graph, name.str(), partition.part)){
+            cerr << "partition: cannot store " << name.str() << " in the cache\n";
+        }
+    }
+    delete graph;
+    return 0;
+}
+
+/* Binary results file.
+   FILE FORMAT (native endianness):
+        char magic[8]           "STABRSLT"
+        uint32_t version
+        uint32_t reserved
+        records, each           uint32_t type, uint32_t reserved, uint64_t length, payload[length]
+
+   RECORDS:
+        SUMMARY     ResultSummary
+        HEATMAP     int64_t nodes, int64_t count, then count Heatmap::Entry (active nodes only)
+        CAUSALITY   CausalityStats
+        QUANTILES   ResultQuantiles
+        SURVIVAL    int64_t count, then count (double time, double survival) Kaplan-Meier points */
+
+struct ResultSummary {
+    char topology[64];          // Topology key
+    int64_t nodes;
+    int64_t faults;
+    int64_t trials;
+    int64_t stabilized;
+    int64_t steps;              // Summed over stabilized trials
+    int64_t budget;
+};
+
+/* Step and wall time distribution of the stabilized trials. */
+
+struct ResultQuantiles {
+    double steps[5];            // mean, standard deviation, p50, p99, p99.9
+    double time[5];             // The same for microseconds per trial
+
+    static ResultQuantiles From(const TrialStatistics& statistics){
+        ResultQuantiles result;
+        const Welford* welford[2] = { &statistics.steps, &statistics.time };
+        const QuantileSketch* sketch[2] = { &statistics.stepQuantiles, &statistics.timeQuantiles };
+
+        for (int s = 0; s < 2; s++){
+            double* out = (s == 0) ? result.steps : result.time;
+
+            out[0] = welford[s]->Mean();
+            out[1] = welford[s]->Deviation();
+            out[2] = sketch[s]->Quantile(0.5);
+            out[3] = sketch[s]->Quantile(0.99);
+            out[4] = sketch[s]->Quantile(0.999);
+        }
+        return result;
+    }
+};
+
+class ResultsFile {
+private:
+    FILE* file;
+
+public:
+    enum Record { SUMMARY = 1, HEATMAP = 2, CAUSALITY = 3, QUANTILES = 4, SURVIVAL = 5, TOPOLOGY = 6 };
+
+    ResultsFile() : file(NULL){}
+
+    ~ResultsFile(){
+        if (file != NULL){
+            fclose(file);
+        }
+    }
+
+    /* Flushes and closes the file. Returns false when buffered records could not be written. */
+
+    bool Close(){
+        bool ok = (file != NULL) && (fflush(file) == 0);
+
+        if (file != NULL){
+            ok = (fclose(file) == 0) && ok;
+            file = NULL;
+        }
+        return ok;
+    }
+
+    bool Open(const string& path){
+        uint32_t version[2] = { 1, 0 };
+
+        file = fopen(path.c_str(), "wb");
+        return (file != NULL) && (fwrite("STABRSLT", 1, 8, file) == 8) && (fwrite(version, sizeof(version), 1, file) == 1);
+    }
+
+    /* Writes one record made of the given payload pieces. */
+
+    bool Write(uint32_t type, const vector< pair<const void*, uint64_t> >& pieces){
+        uint32_t header[2] = { type, 0 };
+        uint64_t length = 0;
+        bool ok;
+
+        for (size_t i = 0; i < pieces.size(); i++){
+            length += pieces[i].second;
+        }
+        ok = (fwrite(header, sizeof(header), 1, file) == 1) && (fwrite(&length, sizeof(length), 1, file) == 1);
+        for (size_t i = 0; ok && (i < pieces.size()); i++){
+            ok = (pieces[i].second == 0) || (fwrite(pieces[i].first, 1, pieces[i].second, file) == pieces[i].second);
+        }
+        return ok;
+    }
+
+    bool WriteSummary(const ResultSummary& summary){
+        return Write(SUMMARY, vector< pair<const void*, uint64_t> >(1, make_pair((const void*)&summary, (uint64_t)sizeof(summary))));
+    }
+
+    bool WriteHeatmap(int64_t nodes, const vector<Heatmap::Entry>& active){
+        int64_t count = active.size();
+        vector< pair<const void*, uint64_t> > pieces;
+
+        pieces.push_back(make_pair((const void*)&nodes, (uint64_t)sizeof(nodes)));
+        pieces.push_back(make_pair((const void*)&count, (uint64_t)sizeof(count)));
+        pieces.push_back(make_pair(active.empty() ? NULL : (const void*)&active[0], (uint64_t)(count * sizeof(Heatmap::Entry))));
+        return Write(HEATMAP, pieces);
+    }
+
+    bool WriteCausality(const CausalityStats& stats){
+        return Write(CAUSALITY, vector< pair<const void*, uint64_t> >(1, make_pair((const void*)&stats, (uint64_t)sizeof(stats))));
+    }
+
+    bool WriteQuantiles(const ResultQuantiles& quantiles){
+        return Write(QUANTILES, vector< pair<const void*, uint64_t> >(1, make_pair((const void*)&quantiles, (uint64_t)sizeof(quantiles))));
+    }
+
+    bool WriteSurvival(const vector< pair<double, double> >& curve){
+        int64_t count = curve.size();
+        vector< pair<const void*, uint64_t> > pieces;
+
+        pieces.push_back(make_pair((const void*)&count, (uint64_t)sizeof(count)));
+        pieces.push_back(make_pair(curve.empty() ? NULL : (const void*)&curve[0], (uint64_t)(count * sizeof(curve[0]))));
+        return Write(SURVIVAL, pieces);
+    }
+
+    bool WriteMetrics(const TopologyMetrics& metrics){
+        return Write(TOPOLOGY, vector< pair<const void*, uint64_t> >(1, make_pair((const void*)&metrics, (uint64_t)sizeof(metrics))));
+    }
+};
+
+/* Parallel Monte Carlo driver over a shared topology.
+   Every worker thread owns a System (and optional instruments) and runs a share of the
+   trials; trial t is seeded from (seed, t), so the results do not depend on the number of
+   threads. Per-worker instruments are merged once all workers finish. */
+
+class MonteCarlo {
+public:
+    struct Worker {
+        System* system;
+        TrialTotals totals;
+        Heatmap* heatmap;
+        CausalityStats causality;
+        TrialStatistics statistics;
+        StepTracer* tracer;
+        Watchpoints* watch;
+        Progress* progress;     // Published when progressEvery > 0, else NULL
+        ActivationLog::Cursor* cursor;  // Replay of the log, NULL for the random scheduler
+        int64_t exhausted;      // Trials the log ended in
+        Scheduler* scheduler;   // NULL for the random scheduler
+        int64_t rounds;         // Scheduler rounds of the stabilized trials
+    };
+
+private:
+    const Graph& graph;
+    int threads;
+    vector<Worker> workers;
+    vector<Progress*> progress; // One per thread, never reallocated so other threads can read it
+    vector<int> colors;         // Coloring computed for CENTRAL when none is given
+
+public:
+    int faults;
+    int trials;
+    int first;                  // Index of the first trial, so runs can extend earlier ones
+    long budget;
+    uint64_t seed;
+    bool heatmaps;              // Collect per-node heatmaps
+    bool causality;             // Attribute rule firings to faults
+    bool pin;                   // Pin worker w to the wth allowed CPU
+    long traceEvery;            // Mean steps (or microseconds) between traced steps, 0 for none
+    bool traceTimed;            // traceEvery is in microseconds
+    size_t traceCapacity;       // Records kept per worker
+    vector<Watchpoints::Watch> watches;
+    size_t watchCapacity;       // Watch events kept per worker
+    long progressEvery;         // Steps between safe points that publish progress, 0 for none
+    const atomic<bool>* cancel; // Stops Run() at the next safe point or trial once set, NULL for none
+    string dumpPrefix;          // Configuration dumps on request, see Progress
+    const ActivationLog* replay;    // Scheduler log every trial replays from its start, NULL for random
+    Scheduler::Kind scheduling;
+    int fairness;               // k of a FAIR scheduler
+    const int* coloring;        // Node colors for a CENTRAL scheduler, NULL to compute them
+    RuleConstants constants;
+
+    MonteCarlo(const Graph& _graph, int _threads)
+        : graph(_graph), threads(max(1, _threads)), faults(1), trials(1), first(0), budget(1000000), seed(1),
+          heatmaps(false), causality(false), pin(false), traceEvery(0), traceTimed(false), traceCapacity(100000),
+          watchCapacity(16), progressEvery(0), cancel(NULL), replay(NULL),
+          scheduling(Scheduler::RANDOM), fairness(2), coloring(NULL), constants(RuleConstants::Default()){
+        for (int w = 0; w < threads; w++){
+            progress.push_back(new Progress(65536, w));
+        }
+    }
+
+    ~MonteCarlo(){
+        for (size_t w = 0; w < workers.size(); w++){
+            delete workers[w].system;
+            delete workers[w].heatmap;
+            delete workers[w].tracer;
+            delete workers[w].watch;
+            delete workers[w].cursor;
+            delete workers[w].scheduler;
+        }
+        for (size_t w = 0; w < progress.size(); w++){
+            delete progress[w];
+        }
+    }
+
+    /* Runs trial t on a worker. */
+
+    void Trial(Worker& worker, int t){
+        System& system = *worker.system;
+
+        system.Seed(MixSeed(seed, t, 0));
+        system.Reset();
+        if (worker.tracer != NULL){
+            worker.tracer->trial = t;
+        }
+        if (worker.watch != NULL){
+            worker.watch->trial = t;
+        }
+        for (int i = 0; i < faults; i++){
+            system.TransientFault();
+        }
+        if (worker.progress != NULL){
+            worker.progress->trial.store(t, memory_order_relaxed);
+        }
+        double start = Microseconds();
+        long steps = system.Stabilize(false, budget);
+        // A trial that stabilized, ran out its budget or its replay log finished even if
+        // the run was cancelled meanwhile; only one stopped early by the cancellation is dropped.
+        if (!system.LegalConfig() && (steps != budget) && !system.Exhausted() && Cancelled()){
+            return;     // Neither stabilized nor censored, the trial did not finish
+        }
+        if (worker.progress != NULL){
+            worker.progress->trials.fetch_add(1, memory_order_relaxed);
+        }
+        worker.exhausted += system.Exhausted();
+        if (system.LegalConfig()){
+            worker.totals.steps += steps;
+            worker.totals.stabilized++;
+            worker.statistics.Add(steps, Microseconds() - start);
+            worker.rounds += system.Rounds();
+        }
+        else {
+            worker.statistics.Censor(steps);
+        }
+        if (causality){
+            system.CollectCausality(worker.causality);
+        }
+    }
+
+    /* Runs all trials and returns the merged totals.
+       The driver can be run again, e.g. with other constants; worker Systems are kept. */
+
+    TrialTotals Run(){
+        int count = min(threads, trials);
+        TrialTotals totals = { 0, 0 };
+
+        for (size_t w = count; w < workers.size(); w++){
+            delete workers[w].system;
+            delete workers[w].heatmap;
+            delete workers[w].tracer;
+            delete workers[w].watch;
+            delete workers[w].cursor;
+            delete workers[w].scheduler;
+        }
+        workers.resize(count);
+        if ((scheduling == Scheduler::CENTRAL) && (coloring == NULL) && ((int)colors.size() != graph.Size())){
+            colors = Scheduler::Coloring(graph);
+        }
+        for (size_t w = 0; w < progress.size(); w++){
+            progress[w]->trials = 0;
+            progress[w]->disagree = 0;
+            progress[w]->enabled = 0;
+        }
+        for (int w = 0; w < count; w++){
+            if (workers[w].system == NULL){
+                workers[w].system = new System(&graph);
+            }
+            delete workers[w].heatmap;
+            delete workers[w].tracer;
+            workers[w].totals = totals;
+            workers[w].heatmap = heatmaps ? new Heatmap(graph.Size()) : NULL;
+            workers[w].system->SetHeatmap(workers[w].heatmap);
+            workers[w].tracer = (traceEvery > 0) ? new StepTracer(traceEvery, traceTimed, traceCapacity, MixSeed(seed, w, 5)) : NULL;
+            workers[w].system->SetTracer(workers[w].tracer);
+            delete workers[w].watch;
+            workers[w].watch = watches.empty() ? NULL : new Watchpoints(watches, watchCapacity);
+            workers[w].system->SetWatchpoints(workers[w].watch);
+            workers[w].progress = (progressEvery > 0) ? progress[w] : NULL;
+            if (workers[w].progress != NULL){
+                workers[w].progress->interval = progressEvery;
+                workers[w].progress->cancel = cancel;
+                workers[w].progress->dumpPrefix = dumpPrefix;
+            }
+            workers[w].system->SetProgress(workers[w].progress);
+            delete workers[w].cursor;
+            workers[w].cursor = (replay != NULL) ? new ActivationLog::Cursor(*replay) : NULL;
+            workers[w].system->SetSchedule(workers[w].cursor);
+            workers[w].exhausted = 0;
+            delete workers[w].scheduler;
+            workers[w].scheduler = (scheduling == Scheduler::RANDOM) ? NULL :
+                                   new Scheduler(graph, scheduling, fairness, (coloring != NULL) ? coloring : &colors[0]);
+            workers[w].system->SetScheduler(workers[w].scheduler);
+            workers[w].rounds = 0;
+            workers[w].causality = CausalityStats();
+            workers[w].statistics = TrialStatistics(MixSeed(seed, w, 6));
+            workers[w].system->EnableCausality(causality);
+            workers[w].system->SetConstants(constants);
+        }
+        ParallelFor(count, count, [this, count](int w, int64_t, int64_t){
+            if (pin){
+                PinThread(w);
+            }
+            for (int t = (int64_t)trials * w / count; (t < (int64_t)trials * (w + 1) / count) && !Cancelled(); t++){
+                Trial(workers[w], first + t);
+            }
+        });
+        if (pin){
+            UnpinThread();  // Worker 0 ran on the calling thread
+        }
+        for (int w = 0; w < count; w++){
+            totals.steps += workers[w].totals.steps;
+            totals.stabilized += workers[w].totals.stabilized;
+            if (w > 0 && heatmaps){
+                workers[0].heatmap->Merge(*workers[w].heatmap);
+            }
+        }
+        return totals;
+    }
+
+    bool Cancelled() const {
+        return (cancel != NULL) && cancel->load(memory_order_relaxed);
+    }
+
+    /* Trials the current or last Run() has finished, and the disagreement and enabled nodes
+       at the last safe point, summed over the trials in flight. Safe to call from another
+       thread while Run() works; 0 unless progressEvery > 0. */
+
+    int64_t Finished(int64_t& disagree, int64_t& enabled) const {
+        int64_t finished = 0;
+
+        disagree = 0;
+        enabled = 0;
+        for (size_t w = 0; w < progress.size(); w++){
+            finished += progress[w]->trials.load(memory_order_relaxed);
+            disagree += progress[w]->disagree.load(memory_order_relaxed);
+            enabled += progress[w]->enabled.load(memory_order_relaxed);
+        }
+        return finished;
+    }
+
+    /* Trials of the last Run() that the replayed log ended in before they stabilized. */
+
+    int64_t Exhausted() const {
+        int64_t exhausted = 0;
+
+        for (size_t w = 0; w < workers.size(); w++){
+            exhausted += workers[w].exhausted;
+        }
+        return exhausted;
+    }
+
+    /* Scheduler rounds of the stabilized trials of the last Run(). */
+
+    int64_t Rounds() const {
+        int64_t rounds = 0;
+
+        for (size_t w = 0; w < workers.size(); w++){
+            rounds += workers[w].rounds;
+        }
+        return rounds;
+    }
+
+    /* Step and time distribution of the last Run(), merged over the workers. */
+
+    TrialStatistics MergedStatistics() const {
+        TrialStatistics statistics(seed);
+
+        for (size_t w = 0; w < workers.size(); w++){
+            statistics.Merge(workers[w].statistics);
+        }
+        return statistics;
+    }
+
+    /* Causality totals of the last Run(), merged over the workers. */
+
+    CausalityStats MergedCausality() const {
+        CausalityStats stats;
+
+        for (size_t w = 0; w < workers.size(); w++){
+            stats.Merge(workers[w].causality);
+        }
+        return stats;
+    }
+
+    /* Traced steps of the last Run() in trial and step order; seen is set to the number of
+       samples taken, of which the workers kept at most traceCapacity each. */
+
+    vector<TraceRecord> MergedTrace(int64_t& seen) const {
+        vector<TraceRecord> records;
+
+        seen = 0;
+        for (size_t w = 0; w < workers.size(); w++){
+            if (workers[w].tracer != NULL){
+                seen += workers[w].tracer->Seen();
+                records.insert(records.end(), workers[w].tracer->Records().begin(), workers[w].tracer->Records().end());
+            }
+        }
+        sort(records.begin(), records.end(), [](const TraceRecord& a, const TraceRecord& b){
+            return (a.trial != b.trial) ? (a.trial < b.trial) : (a.step < b.step);
+        });
+        return records;
+    }
+
+    /* The first watchCapacity watch events of the last Run() in trial order; fired and aborted
+       are set to the number of events and of aborted trials. */
+
+    vector<Watchpoints::Event> MergedWatchEvents(int64_t& fired, int64_t& aborted) const {
+        vector<Watchpoints::Event> events;
+
+        fired = 0;
+        aborted = 0;
+        for (size_t w = 0; w < workers.size(); w++){
+            if (workers[w].watch != NULL){
+                fired += workers[w].watch->fired;
+                aborted += workers[w].watch->aborted;
+                events.insert(events.end(), workers[w].watch->events.begin(), workers[w].watch->events.end());
+            }
+        }
+        stable_sort(events.begin(), events.end(), [](const Watchpoints::Event& a, const Watchpoints::Event& b){
+            return (a.trial != b.trial) ? (a.trial < b.trial) : (a.step < b.step);
+        });
+        if (events.size() > watchCapacity){
+            events.resize(watchCapacity);   // Workers run consecutive trials, so these are the first overall
+        }
+        return events;
+    }
+
+    /* Merged heatmap of the last Run(), or NULL when not collected. */
+
+    const Heatmap* MergedHeatmap() const {
+        return (heatmaps && !workers.empty()) ? workers[0].heatmap : NULL;
+    }
+};
+
+/* Set by SIGINT during a run, which then stops at the next safe point with the trials it
+   finished. The handler resets, so a second SIGINT terminates. */
+
+atomic<bool> runCancelled(false);
+
+void CancelRun(int){
+    runCancelled = true;
+}
+
+/* Prints the trials finished by driver, an estimate of the time left, and the disagreement
+   and enabled nodes in flight with their change since the last report, every seconds until
+   done is set. */
+
+void MonitorProgress(const MonteCarlo& driver, int trials, double seconds, bool& done, mutex& lock, condition_variable& wake){
+    double start = Microseconds();
+    int64_t lastDisagree = 0, lastEnabled = 0;
+    unique_lock<mutex> hold(lock);
+
+    while (!wake.wait_for(hold, chrono::microseconds((long)(seconds * 1e6)), [&done](){ return done; })){
+        int64_t disagree, enabled;
+        int64_t finished = driver.Finished(disagree, enabled);
+        double elapsed = (Microseconds() - start) / 1e6;
+
+        cerr << "progress: " << finished << '/' << trials << " trials";
+        if (finished > 0){
+            cerr << ", " << elapsed * (trials - finished) / finished << " s left";
+        }
+        cerr << ", in flight disagree " << disagree << " (" << showpos << disagree - lastDisagree << noshowpos
+             << ") enabled " << enabled << " (" << showpos << enabled - lastEnabled << noshowpos << ")\n";
+        lastDisagree = disagree;
+        lastEnabled = enabled;
+    }
+}
+
+/* Run mode: fault/stabilize trials of System on any topology. */
+
+int RunGraph(const Options& options){
+    int cores = max(1, (int)thread::hardware_concurrency());
+    Graph* graph = LoadTopology(options);
+
+    if (graph == NULL){
+        cerr << "run: cannot build " << TopologyKey(options) << '\n';
+        return 1;
+    }
+
+    MonteCarlo driver(*graph, options.Get("threads", (long)cores));
+    driver.faults = options.Get("faults", 1L);
+    driver.trials = options.Get("trials", 100L);
+    driver.budget = options.Get("budget", 1000000L);
+    driver.seed = options.Get("seed", (long)rand());
+    driver.heatmaps = options.Has("heatmap") && (options.Get("heatmap", "on") != "off");
+    driver.causality = options.Has("causality") && (options.Get("causality", "on") != "off");
+    driver.traceTimed = options.Has("trace-us");
+    driver.traceEvery = driver.traceTimed ? options.Get("trace-us", 0L) : options.Get("trace-every", options.Has("trace") ? 1000L : 0L);
+    driver.traceCapacity = options.Get("trace-capacity", 100000L);
+    driver.watchCapacity = options.Get("watch-capacity", 16L);
+    if (!Watchpoints::Parse(options.Get("watch", ""), driver.watches)){
+        cerr << "run: expected --watch disagreement|secondary|radius>limit:snapshot|dump|abort,...\n";
+        delete graph;
+        return 1;
+    }
+    if ((driver.faults < 0) || (driver.trials < 1) || (driver.budget < 1)){
+        cerr << "run: expected faults >= 0, trials >= 1, budget >= 1\n";
+        delete graph;
+        return 1;
+    }
+
+    ActivationLog* replay = NULL;
+    if (options.Has("replay")){
+        string error;
+
+        if ((replay = ActivationLog::Open(options.Get("replay", ""), graph->Size(), error)) == NULL){
+            cerr << "run: " << error << '\n';
+            delete graph;
+            return 1;
+        }
+        driver.replay = replay;
+    }
+
+    string scheduling = options.Get("scheduler", "random");
+    vector<int> colors;
+    int64_t colored = 0;
+    driver.fairness = options.Get("fairness", 2L);
+    if (scheduling == "fair"){
+        driver.scheduling = Scheduler::FAIR;
+    }
+    else if (scheduling == "central"){
+        driver.scheduling = Scheduler::CENTRAL;
+        driver.coloring = graph->Section("color", &colored);
+        if ((driver.coloring == NULL) || (colored != graph->Size()) || !Scheduler::ProperColoring(*graph, driver.coloring)){
+            colors = Scheduler::Coloring(*graph);
+            driver.coloring = &colors[0];
+            if (graph->Mapped()){
+                const char* environment = getenv("STABILIZATION_CACHE");
+                TopologyCache cache(options.Get("cache", environment ? string(environment) : string()));
+
+                if (!cache.AddSection(TopologyKey(options), *graph, "color", colors)){
+                    cerr << "run: cannot store the coloring in the cache\n";
+                }
+            }
+        }
+        colored = *max_element(driver.coloring, driver.coloring + graph->Size()) + 1;
+    }
+    if (((scheduling != "random") && (driver.scheduling == Scheduler::RANDOM)) || (driver.fairness < 1)){
+        cerr << "run: expected --scheduler random|fair|central and fairness >= 1\n";
+        delete replay;
+        delete graph;
+        return 1;
+    }
+
+    driver.progressEvery = options.Get("safe-points", 65536L);
+    driver.dumpPrefix = options.Get("dump", "");
+    driver.cancel = &runCancelled;
+    runCancelled = false;
+    if (driver.progressEvery < 1){
+        cerr << "run: expected safe-points >= 1\n";
+        delete replay;
+        delete graph;
+        return 1;
+    }
+
+    struct sigaction interrupt, dump;
+    memset(&interrupt, 0, sizeof(interrupt));
+    memset(&dump, 0, sizeof(dump));
+    interrupt.sa_handler = CancelRun;
+    interrupt.sa_flags = SA_RESETHAND;
+    dump.sa_handler = Progress::OnSignal;
+    dump.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &interrupt, NULL);
+    sigaction(SIGUSR1, &dump, NULL);
+
+    bool done = false;
+    mutex lock;
+    condition_variable wake;
+    thread monitor;
+    double every = atof(options.Get("progress", "0").c_str());
+    if (every > 0){
+        monitor = thread(MonitorProgress, cref(driver), driver.trials, every, ref(done), ref(lock), ref(wake));
+    }
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+    TrialTotals totals = driver.Run();
+    double seconds = (boost::posix_time::microsec_clock::local_time() - start).total_microseconds() / 1e6;
+
+    if (monitor.joinable()){
+        lock.lock();
+        done = true;
+        lock.unlock();
+        wake.notify_one();
+        monitor.join();
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGUSR1, SIG_DFL);
+
+    int64_t disagree, enabled;
+    int64_t finished = driver.Finished(disagree, enabled);
+
+    cout << TopologyKey(options) << ", faults " << driver.faults << ", trials " << driver.trials << '\n';
+    if (driver.Cancelled()){
+        cout << "cancelled: " << finished << " trials finished, the rest are left out\n";
+    }
+    if (replay != NULL){
+        cout << "replay: " << replay->Count() << " activations (" << (replay->Binary() ? "binary" : "text") << "), "
+             << driver.Exhausted() << " trials ran past the end, censored\n";
+    }
+    if (driver.scheduling != Scheduler::RANDOM){
+        if (driver.scheduling == Scheduler::FAIR){
+            cout << "scheduler: " << driver.fairness << "-bounded fair, ";
+        }
+        else {
+            cout << "scheduler: locally central over " << colored << " colors, ";
+        }
+        cout << (totals.stabilized ? (double)driver.Rounds() / totals.stabilized : 0) << " rounds per stabilized trial\n";
+    }
+    cout << "stabilized: " << totals.stabilized << " within " << driver.budget << " steps\n";
+    cout << "mean steps: " << (totals.stabilized ? (double)totals.steps / totals.stabilized : 0) << '\n';
+    cout << "trials/sec: " << (seconds > 0 ? finished / seconds : 0) << '\n';
+
+    TrialStatistics statistics = driver.MergedStatistics();
+    ResultQuantiles quantiles = ResultQuantiles::From(statistics);
+    cout << "steps: sd " << quantiles.steps[1] << ", p50 " << quantiles.steps[2] << ", p99 " << quantiles.steps[3]
+         << ", p99.9 " << quantiles.steps[4] << '\n';
+    cout << "microseconds: mean " << quantiles.time[0] << ", p50 " << quantiles.time[2] << ", p99 " << quantiles.time[3]
+         << ", p99.9 " << quantiles.time[4] << '\n';
+
+    // Budget exhausted trials are right-censored, so these cover every trial without bias.
+    vector< pair<double, double> > curve = statistics.survival.Curve();
+    double medianSteps = statistics.survival.Quantile(0.5);
+    cout << "survival: restricted mean " << statistics.survival.RestrictedMean(driver.budget) << " steps (tau " << driver.budget
+         << "), Kaplan-Meier median ";
+    if (medianSteps < 0){
+        cout << "beyond the budget";
+    }
+    else {
+        cout << medianSteps;
+    }
+    cout << ", S(budget) " << curve.back().second << '\n';
+    if (options.Has("survival")){
+        ofstream plot(options.Get("survival", "").c_str());
+
+        plot << "# steps survival\n";
+        for (size_t i = 0; i < curve.size(); i++){
+            plot << curve[i].first << ' ' << curve[i].second << '\n';
+        }
+        if (!plot){
+            cerr << "run: cannot write " << options.Get("survival", "") << '\n';
+        }
+    }
+
+    TopologyMetrics metrics = TopologyMetrics::Of(*graph, options.Get("threads", (long)cores), options.Get("metric-samples", 10000L),
+                                                  options.Get("metric-sources", 64L), 1);
+    metrics.Print(cout);
+
+    vector<Heatmap::Entry> active;
+    if (driver.MergedHeatmap() != NULL){
+        active = driver.MergedHeatmap()->Active();
+        cout << "heatmap: " << active.size() << " active nodes\n";
+    }
+
+    CausalityStats causality = driver.MergedCausality();
+    if (driver.causality && (causality.faults > 0)){
+        cout << "causality: " << (double)causality.reached / causality.faults << " nodes and radius "
+             << (double)causality.radius / causality.faults << " per fault (max " << causality.maxRadius << "), "
+             << 100.0 * causality.interacting / max((int64_t)1, causality.firings) << "% of firings from interacting faults\n";
+    }
+
+    if (driver.traceEvery > 0){
+        int64_t seen;
+        vector<TraceRecord> trace = driver.MergedTrace(seen);
+        int64_t rules[4] = { 0, 0, 0, 0 };
+        const char* ruleNames[4] = { "none", "3", "2a", "2b" };
+
+        for (size_t r = 0; r < trace.size(); r++){
+            rules[trace[r].rule]++;
+        }
+        cout << "trace: " << seen << " steps sampled, " << trace.size() << " kept; rules";
+        for (int k = 0; k < 4; k++){
+            cout << ' ' << ruleNames[k] << ' ' << 100.0 * rules[k] / max((size_t)1, trace.size()) << '%';
+        }
+        cout << '\n';
+        if (options.Has("trace")){
+            ofstream out(options.Get("trace", "").c_str());
+
+            out << "# trial step node rule primary secondary neighbor_max unequal degree disagree"
+                   " neighbor:primary:secondary...\n";
+            for (size_t r = 0; r < trace.size(); r++){
+                const TraceRecord& record = trace[r];
+
+                out << record.trial << ' ' << record.step << ' ' << record.node << ' ' << ruleNames[record.rule] << ' '
+                    << record.primary << ' ' << record.secondary << ' ' << record.neighborMax << ' ' << record.unequal << ' '
+                    << record.degree << ' ' << record.disagree;
+                for (int k = 0; (k < TraceRecord::NEIGHBORS) && (record.neighbor[k] >= 0); k++){
+                    out << ' ' << record.neighbor[k] << ':' << record.neighborPrimary[k] << ':' << record.neighborSecondary[k];
+                }
+                out << '\n';
+            }
+            if (!out){
+                cerr << "run: cannot write " << options.Get("trace", "") << '\n';
+            }
+        }
+    }
+
+    if (!driver.watches.empty()){
+        int64_t fired, aborted;
+        vector<Watchpoints::Event> events = driver.MergedWatchEvents(fired, aborted);
+        const char* predicateNames[3] = { "disagreement", "secondary", "radius" };
+        const char* actionNames[3] = { "snapshot", "dump", "abort" };
+        ofstream out;
+
+        cout << "watch: " << fired << " events, " << events.size() << " kept, " << aborted << " trials aborted\n";
+        if (options.Has("watch-out")){
+            out.open(options.Get("watch-out", "").c_str());
+        }
+        for (size_t e = 0; e < events.size(); e++){
+            const Watchpoints::Event& event = events[e];
+            const Watchpoints::Watch& watch = driver.watches[event.watch];
+            stringstream line;
+
+            line << predicateNames[watch.predicate] << '>' << watch.limit << ':' << actionNames[watch.action] << " trial "
+                 << event.trial << " step " << event.step << " node " << event.node << " value " << event.value;
+            cout << "  " << line.str() << '\n';
+            if (out.is_open()){
+                out << "# " << line.str() << '\n';
+                for (size_t k = 0; k < event.snapshot.size(); k++){
+                    out << k << ' ' << event.snapshot[k].first << ' ' << event.snapshot[k].second << '\n';
+                }
+                for (size_t r = 0; r < event.trace.size(); r++){
+                    out << "trace " << event.trace[r].step << ' ' << event.trace[r].node << ' ' << event.trace[r].rule << ' '
+                        << event.trace[r].secondary << ' ' << event.trace[r].disagree << '\n';
+                }
+            }
+        }
+        if (out.is_open() && !out){
+            cerr << "run: cannot write " << options.Get("watch-out", "") << '\n';
+        }
+    }
+
+    if (options.Has("results")){
+        ResultsFile results;
+        ResultSummary summary;
+
+        memset(&summary, 0, sizeof(summary));
+        strncpy(summary.topology, TopologyKey(options).c_str(), sizeof(summary.topology) - 1);
+        summary.nodes = graph->Size();
+        summary.faults = driver.faults;
+        summary.trials = finished;
+        summary.stabilized = totals.stabilized;
+        summary.steps = totals.steps;
+        summary.budget = driver.budget;
+        if (!results.Open(options.Get("results", "")) || !results.WriteSummary(summary) ||
+            (driver.heatmaps && !results.WriteHeatmap(graph->Size(), active)) ||
+            (driver.causality && !results.WriteCausality(causality)) || !results.WriteQuantiles(quantiles) ||
+            !results.WriteSurvival(curve) || !results.WriteMetrics(metrics) || !results.Close()){
+            cerr << "run: cannot write " << options.Get("results", "") << '\n';
+            delete replay;
+            delete graph;
+            return 1;
+        }
+    }
+    delete replay;
+    delete graph;
+    return driver.Cancelled() ? 128 + SIGINT : 0;
+}
+
+/* Reads a sweep written by the pipeline: a "# name name ..." header followed by rows of
+   numbers. Returns one column-name -> value map per row. */
+
+vector< map<string, double> > ReadSweep(const string& path){
+    ifstream in(path.c_str());
+    vector< map<string, double> > rows;
+    vector<string> columns;
+    string line;
+
+    while (getline(in, line)){
+        stringstream fields(line);
+        string field;
+
+        if (line.empty()){
+            continue;
+        }
+        if (line[0] == '#'){
+            columns.clear();
+            fields.ignore(1);
+            while (fields >> field){
+                columns.push_back(field);
+            }
+            continue;
+        }
+
+        map<string, double> row;
+        for (size_t c = 0; (c < columns.size()) && (fields >> field); c++){
+            row[columns[c]] = atof(field.c_str());
+        }
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+/* Least squares line y = a + b x with its coefficient of determination. */
+
+struct LineFit {
+    double a;
+    double b;
+    double r2;
+
+    static LineFit Of(const vector<double>& x, const vector<double>& y){
+        LineFit fit = { 0, 0, 0 };
+        double n = x.size(), sx = 0, sy = 0, sxx = 0, sxy = 0, ss = 0, residual = 0;
+
+        for (size_t i = 0; i < x.size(); i++){
+            sx += x[i];
+            sy += y[i];
+        }
+        for (size_t i = 0; i < x.size(); i++){
+            sxx += (x[i] - sx / n) * (x[i] - sx / n);
+            sxy += (x[i] - sx / n) * (y[i] - sy / n);
+        }
+        fit.b = (sxx > 0) ? sxy / sxx : 0;
+        fit.a = sy / n - fit.b * sx / n;
+        for (size_t i = 0; i < x.size(); i++){
+            double e = y[i] - (fit.a + fit.b * x[i]);
+
+            residual += e * e;
+            ss += (y[i] - sy / n) * (y[i] - sy / n);
+        }
+        fit.r2 = (ss > 0) ? 1 - residual / ss : 1;
+        return fit;
+    }
+};
+
+/* Scaling models of a metric y against a parameter n:
+       POWER   y = c n^b, fitted as ln y = ln c + b ln n over the points with y > 0
+       LOG     y = a + b ln n
+   Confidence intervals come from a bootstrap over all cores: when the metric has a
+   standard deviation column each replicate redraws every cell mean from its sampling
+   distribution, otherwise it resamples the fit residuals. */
+
+class ScalingFit {
+public:
+    enum Model { POWER, LOG, MODELS };
+
+    struct Result {
+        bool valid;             // At least two points the model can use
+        LineFit fit;
+        double aLow, aHigh;     // 95% interval of the intercept (ln c for POWER)
+        double bLow, bHigh;     // 95% interval of the exponent or slope
+    };
+
+private:
+    vector<double> n;
+    vector<double> y;
+    vector<double> error;       // Standard error of each y, empty when unknown
+
+    /* Points the model can use: POWER skips nonpositive y, whose logarithm is undefined. */
+
+    static bool Usable(Model model, double y){
+        return (model != POWER) || (y > 0);
+    }
+
+    /* Fits model to its usable points. Returns false when fewer than two are left. */
+
+    static bool Fit(Model model, const vector<double>& n, const vector<double>& y, LineFit& fit){
+        vector<double> x, v;
+
+        for (size_t i = 0; i < n.size(); i++){
+            if (Usable(model, y[i])){
+                x.push_back(log(n[i]));
+                v.push_back((model == POWER) ? log(y[i]) : y[i]);
+            }
+        }
+        if (x.size() < 2){
+            return false;
+        }
+        fit = LineFit::Of(x, v);
+        return true;
+    }
+
+    static double Gaussian(Random& random){
+        double u = ((random.Next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+        double v = ((random.Next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+
+        return sqrt(-2 * log(u)) * cos(6.283185307179586 * v);
+    }
+
+public:
+    ScalingFit(const vector<double>& _n, const vector<double>& _y, const vector<double>& _error)
+        : n(_n), y(_y), error(_error){}
+
+    Result Run(Model model, int replicates, int threads, uint64_t seed) const {
+        Result result;
+        vector<double> a(replicates), b(replicates);
+        vector<size_t> usable;
+        LineFit base;
+
+        for (size_t i = 0; i < y.size(); i++){
+            if (Usable(model, y[i])){
+                usable.push_back(i);
+            }
+        }
+        result.valid = Fit(model, n, y, base);
+        if (!result.valid){
+            return result;
+        }
+        result.fit = base;
+        ParallelFor(threads, replicates, [&](int, int64_t begin, int64_t end){
+            vector<double> sample(y.size());
+
+            for (int64_t r = begin; r < end; r++){
+                Random random(MixSeed(seed, r, model));
+
+                for (size_t i = 0; i < y.size(); i++){
+                    if (!error.empty()){
+                        sample[i] = y[i] + error[i] * Gaussian(random);
+                    }
+                    else {
+                        // Residual bootstrap in the fitted space, over the usable points.
+                        size_t j = usable[random.Below(usable.size())];
+                        double x = log(n[j]);
+                        double fitted = base.a + base.b * x;
+                        double residual = ((model == POWER) ? log(y[j]) : y[j]) - fitted;
+                        double value = base.a + base.b * log(n[i]) + residual;
+
+                        sample[i] = (model == POWER) ? exp(value) : value;
+                    }
+                }
+                LineFit fit;
+
+                // A replicate left with too few usable points is dropped.
+                if (!Fit(model, n, sample, fit)){
+                    fit.a = fit.b = NAN;
+                }
+                a[r] = fit.a;
+                b[r] = fit.b;
+            }
+        });
+        a.erase(remove_if(a.begin(), a.end(), [](double v){ return std::isnan(v); }), a.end());
+        b.erase(remove_if(b.begin(), b.end(), [](double v){ return std::isnan(v); }), b.end());
+        if (a.empty()){
+            a.assign(1, base.a);
+            b.assign(1, base.b);
+        }
+        sort(a.begin(), a.end());
+        sort(b.begin(), b.end());
+        result.aLow = a[(size_t)(0.025 * (a.size() - 1))];
+        result.aHigh = a[(size_t)(0.975 * (a.size() - 1))];
+        result.bLow = b[(size_t)(0.025 * (b.size() - 1))];
+        result.bHigh = b[(size_t)(0.975 * (b.size() - 1))];
+        return result;
+    }
+
+    /* Value of a fitted model at n. */
+
+    static double Evaluate(Model model, const LineFit& fit, double n){
+        return (model == POWER) ? exp(fit.a) * pow(n, fit.b) : fit.a + fit.b * log(n);
+    }
+};
+
+/* Report mode: fits scaling laws to a pipeline sweep.
+   For every fault count the metric is fitted against size, and for every size against
+   the fault count. Writes report.txt (tables) and, per group, a .dat file of the
+   measured points with the fitted curves for plotting. */
+
+int RunReport(const string& path, const Options& options){
+    vector< map<string, double> > rows = ReadSweep(path);
+    string metric = options.Get("metric", "mean_steps");
+    string directory = options.Get("out", "report");
+    int replicates = max(100L, options.Get("bootstrap", 2000L));
+    int threads = options.Get("threads", (long)max(1, (int)thread::hardware_concurrency()));
+    uint64_t seed = options.Get("seed", 1L);
+    string deviation = (metric.compare(0, 5, "mean_") == 0) ? "sd_" + metric.substr(5) : "";
+    const char* modelName[ScalingFit::MODELS] = { "power", "log" };
+    const char* axis[2] = { "size", "faults" };
+
+    if (rows.empty() || !rows[0].count(metric) || !rows[0].count("size") || !rows[0].count("faults")){
+        cerr << "report: " << path << " has no size, faults and " << metric << " columns\n";
+        return 1;
+    }
+    mkdir(directory.c_str(), 0755);
+
+    ofstream report((directory + "/report.txt").c_str());
+    report << "# Scaling of " << metric << " from " << path << ", " << replicates << " bootstrap replicates\n";
+    report << "# against group model coefficient [95% CI] exponent_or_slope [95% CI] r2\n";
+
+    // Axis 0 fits against size within each fault count, axis 1 against faults within each size.
+    for (int x = 0; x < 2; x++){
+        map<double, vector<size_t> > groups;
+
+        for (size_t r = 0; r < rows.size(); r++){
+            groups[rows[r][axis[1 - x]]].push_back(r);
+        }
+        for (map<double, vector<size_t> >::iterator g = groups.begin(); g != groups.end(); ++g){
+            vector<double> n, y, error;
+            bool known = !deviation.empty() && rows[0].count(deviation) && rows[0].count("stabilized");
+
+            for (size_t i = 0; i < g->second.size(); i++){
+                map<string, double>& row = rows[g->second[i]];
+
+                if ((row[axis[x]] <= 0) || (row.count(metric) == 0)){
+                    continue;
+                }
+                n.push_back(row[axis[x]]);
+                y.push_back(row[metric]);
+                if (known){
+                    error.push_back(row[deviation] / sqrt(max(1.0, row["stabilized"])));
+                }
+            }
+            if (n.size() < 3){
+                continue;   // Too few points for a fit with an interval
+            }
+
+            ScalingFit scaling(n, y, error);
+            ScalingFit::Result result[ScalingFit::MODELS];
+            stringstream name;
+
+            name << directory << '/' << metric << "_vs_" << axis[x] << '_' << axis[1 - x] << g->first << ".dat";
+            for (int m = 0; m < ScalingFit::MODELS; m++){
+                result[m] = scaling.Run((ScalingFit::Model)m, replicates, threads, seed);
+                if (!result[m].valid){
+                    report << axis[x] << ' ' << axis[1 - x] << '=' << g->first << ' ' << modelName[m]
+                           << " skipped: fewer than 2 positive values\n";
+                    continue;
+                }
+                report << axis[x] << ' ' << axis[1 - x] << '=' << g->first << ' ' << modelName[m] << ' '
+                       << ((m == ScalingFit::POWER) ? exp(result[m].fit.a) : result[m].fit.a) << " ["
+                       << ((m == ScalingFit::POWER) ? exp(result[m].aLow) : result[m].aLow) << ", "
+                       << ((m == ScalingFit::POWER) ? exp(result[m].aHigh) : result[m].aHigh) << "] "
+                       << result[m].fit.b << " [" << result[m].bLow << ", " << result[m].bHigh << "] "
+                       << result[m].fit.r2 << '\n';
+            }
+
+            ofstream plot(name.str().c_str());
+            plot << "# " << axis[x] << ' ' << metric << " standard_error power_fit log_fit\n";
+            for (size_t i = 0; i < n.size(); i++){
+                plot << n[i] << ' ' << y[i] << ' ' << (error.empty() ? 0 : error[i]) << ' '
+                     << (result[ScalingFit::POWER].valid ? ScalingFit::Evaluate(ScalingFit::POWER, result[ScalingFit::POWER].fit, n[i]) : NAN) << ' '
+                     << (result[ScalingFit::LOG].valid ? ScalingFit::Evaluate(ScalingFit::LOG, result[ScalingFit::LOG].fit, n[i]) : NAN) << '\n';
+            }
+        }
+    }
+
+    if (!report){
+        cerr << "report: cannot write " << directory << "/report.txt\n";
+        return 1;
+    }
+    report.close();
+    ifstream summary((directory + "/report.txt").c_str());
+    cout << summary.rdbuf();
+    return 0;
+}
+
+/* Black-box search of the rule constants for one topology and fault model.
+   Candidates are pruned by successive halving: each rung gives every survivor more trials
+   and keeps the best 1/eta. All candidates run on the same trial seeds (common random
+   numbers), so their differences are not drowned by scheduler noise, and trials of earlier
+   rungs are kept rather than rerun. The objective is either the restricted mean
+   stabilization time up to the budget, which accounts for trials that never stabilize, or
+   the mean containment radius per fault. */
+
+class Tuner {
+public:
+    enum Objective { STEPS, RADIUS };
+
+    struct Candidate {
+        RuleConstants constants;
+        TrialStatistics statistics;
+        CausalityStats causality;
+        int trials;
+        double score;           // Lower is better
+    };
+
+private:
+    MonteCarlo& driver;
+    Objective objective;
+
+    double Score(const Candidate& candidate) const {
+        if (objective == RADIUS){
+            return (double)candidate.causality.radius / max((int64_t)1, candidate.causality.faults);
+        }
+        return candidate.statistics.survival.RestrictedMean(driver.budget);
+    }
+
+    /* Runs trials [first, first + count) of a candidate and adds them to its totals. */
+
+    void Evaluate(Candidate& candidate, int first, int count){
+        driver.constants = candidate.constants;
+        driver.first = first;
+        driver.trials = count;
+        driver.Run();
+        candidate.statistics.Merge(driver.MergedStatistics());
+        candidate.causality.Merge(driver.MergedCausality());
+        candidate.trials += count;
+        candidate.score = Score(candidate);
+    }
+
+public:
+    vector<Candidate> candidates;   // Survivors, best first after Run()
+
+    Tuner(MonteCarlo& _driver, Objective _objective) : driver(_driver), objective(_objective){
+        driver.causality = (objective == RADIUS);
+        driver.heatmaps = false;
+    }
+
+    void Add(const RuleConstants& constants){
+        Candidate candidate;
+
+        candidate.constants = constants;
+        candidate.statistics = TrialStatistics(MixSeed(driver.seed, candidates.size(), 2));
+        candidate.trials = 0;
+        candidate.score = 0;
+        candidates.push_back(candidate);
+    }
+
+    /* Successive halving from trials per candidate until one candidate is left.
+       Reports every rung to log when it is not NULL. */
+
+    void Run(int trials, int eta, ostream* log){
+        int done = 0;
+
+        for (int rung = 0; !candidates.empty(); rung++){
+            for (size_t c = 0; c < candidates.size(); c++){
+                Evaluate(candidates[c], done, trials - done);
+            }
+            stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b){
+                return a.score < b.score;
+            });
+            if (log != NULL){
+                *log << "rung " << rung << ": " << candidates.size() << " candidates, " << trials << " trials each, best "
+                     << candidates[0].score << ", worst " << candidates.back().score << '\n';
+            }
+            if (candidates.size() == 1){
+                break;
+            }
+            candidates.resize(max((size_t)1, candidates.size() / eta));
+            done = trials;
+            trials *= eta;
+        }
+    }
+};
+
+/* Tune mode: searches M, the 2b increment and the initial secondary for a topology. */
+
+int RunTune(const Options& options){
+    int cores = max(1, (int)thread::hardware_concurrency());
+    Graph* graph = LoadTopology(options);
+
+    if (graph == NULL){
+        cerr << "tune: cannot build " << TopologyKey(options) << '\n';
+        return 1;
+    }
+
+    MonteCarlo driver(*graph, options.Get("threads", (long)cores));
+    Tuner::Objective objective = (options.Get("objective", "steps") == "radius") ? Tuner::RADIUS : Tuner::STEPS;
+    int count = options.Get("candidates", 27L);
+    int trials = options.Get("trials", 20L);
+    int eta = options.Get("eta", 3L);
+    vector<int> m = options.List("m", "0,200");
+    vector<int> increment = options.List("increment", "1,16");
+    vector<int> initial = options.List("initial", "0,100");
+
+    driver.faults = options.Get("faults", 1L);
+    driver.budget = options.Get("budget", 100000L);
+    driver.seed = options.Get("seed", (long)rand());
+    if ((driver.faults < 1) || (driver.budget < 1) || (count < 1) || (trials < 1) || (eta < 2) ||
+        (m.size() != 2) || (increment.size() != 2) || (initial.size() != 2) || (increment[0] < 1)){
+        cerr << "tune: expected faults, budget, candidates, trials >= 1, eta >= 2 and ranges lo,hi with increment >= 1\n";
+        delete graph;
+        return 1;
+    }
+
+    // The constants the algorithm was written with always compete.
+    Tuner tuner(driver, objective);
+    tuner.Add(RuleConstants::Default());
+    for (int c = 1; c < count; c++){
+        Random random(MixSeed(driver.seed, c, 1));
+        RuleConstants constants;
+
+        constants.m = m[0] + random.Below(max(1, m[1] - m[0] + 1));
+        constants.increment = increment[0] + random.Below(max(1, increment[1] - increment[0] + 1));
+        constants.initial = initial[0] + random.Below(max(1, initial[1] - initial[0] + 1));
+        tuner.Add(constants);
+    }
+
+    cout << TopologyKey(options) << ", faults " << driver.faults << ", objective "
+         << ((objective == Tuner::RADIUS) ? "containment radius" : "restricted mean steps") << '\n';
+    tuner.Run(trials, eta, &cout);
+
+    const Tuner::Candidate& best = tuner.candidates[0];
+    cout << "best: M " << best.constants.m << ", increment " << best.constants.increment << ", initial "
+         << best.constants.initial << ": " << best.score << " over " << best.trials << " trials, "
+         << best.statistics.survival.Curve().back().second << " unstabilized\n";
+
+    // The defaults on the same trials, for comparison.
+    Tuner baseline(driver, objective);
+    baseline.Add(RuleConstants::Default());
+    baseline.Run(best.trials, eta, NULL);
+    cout << "default: M " << M << ", increment 1, initial 5: " << baseline.candidates[0].score << '\n';
+    delete graph;
+    return 0;
+}
+
+/* One fault count of a density sweep. */
+
+struct DensityPoint {
+    int faults;
+    int trials;
+    int stabilized;
+    double restrictedMean;      // Restricted mean steps up to the budget
+    double median;              // Kaplan-Meier median steps, -1 beyond the budget
+    double radius;              // Mean containment radius per fault, 0 without causality
+
+    /* Size of the change between two points: the log ratio of the restricted means and
+       radii plus the difference of the stabilized shares. */
+
+    double Change(const DensityPoint& other) const {
+        return fabs(log1p(restrictedMean) - log1p(other.restrictedMean)) + fabs(log1p(radius) - log1p(other.radius)) +
+               fabs((double)stabilized / trials - (double)other.stabilized / other.trials);
+    }
+};
+
+/* Density mode: locates the fault densities where stabilization changes sharply.
+   A coarse grid of fault counts is refined for a number of rounds by bisecting the
+   intervals with the greatest change, so trials concentrate around the transitions.
+   Every point runs on the same MonteCarlo driver, whose Systems are reused, and with
+   the same seed, so neighbouring points share trials. With a cache directory the points
+   are kept in a results file named after the sweep parameters and reused by later runs. */
+
+int RunDensity(const Options& options){
+    int cores = max(1, (int)thread::hardware_concurrency());
+    Graph* graph = LoadTopology(options);
+
+    if (graph == NULL){
+        cerr << "density: cannot build " << TopologyKey(options) << '\n';
+        return 1;
+    }
+
+    MonteCarlo driver(*graph, options.Get("threads", (long)cores));
+    int size = graph->Size();
+    int low = max(1L, options.Get("min-faults", 1L));
+    int high = min((long)size, options.Get("max-faults", (long)max(1, size / 2)));
+    int points = options.Get("points", 9L);
+    int rounds = options.Get("rounds", 4L);
+    int refine = options.Get("refine", 4L);
+    const char* environment = getenv("STABILIZATION_CACHE");
+    string directory = options.Get("cache", environment ? string(environment) : string());
+    map<int, DensityPoint> sweep;
+    stringstream name;
+    int64_t ran = 0;
+
+    driver.trials = options.Get("trials", 200L);
+    driver.budget = options.Get("budget", 100000L);
+    driver.seed = options.Get("seed", 1L);
+    driver.causality = options.Has("causality") && (options.Get("causality", "on") != "off");
+    if ((low > high) || (points < 2) || (rounds < 0) || (refine < 1) || (driver.trials < 1) || (driver.budget < 1)){
+        cerr << "density: expected 1 <= min-faults <= max-faults, points >= 2, refine, trials and budget >= 1\n";
+        delete graph;
+        return 1;
+    }
+
+    // Points already measured with the same topology, trials, budget, seed and causality.
+    name << directory << "/density-" << TopologyKey(options) << '-' << driver.trials << '-' << driver.budget << '-'
+         << driver.seed << (driver.causality ? "-causality" : "");
+    if (!directory.empty()){
+        ifstream in(name.str().c_str());
+        DensityPoint point;
+
+        while (in >> point.faults >> point.trials >> point.stabilized >> point.restrictedMean >> point.median >> point.radius){
+            sweep[point.faults] = point;
+        }
+    }
+    size_t cached = sweep.size();
+
+    vector<int> pending;
+    for (int p = 0; p < points; p++){
+        pending.push_back(low + (int)((int64_t)(high - low) * p / (points - 1)));
+    }
+    for (int round = 0; round <= rounds; round++){
+        for (size_t p = 0; p < pending.size(); p++){
+            if (sweep.count(pending[p])){
+                continue;
+            }
+
+            DensityPoint point;
+            driver.faults = pending[p];
+            point.faults = pending[p];
+            point.trials = driver.trials;
+            point.stabilized = driver.Run().stabilized;
+            ran += driver.trials;
+
+            TrialStatistics statistics = driver.MergedStatistics();
+            CausalityStats causality = driver.MergedCausality();
+            point.restrictedMean = statistics.survival.RestrictedMean(driver.budget);
+            point.median = statistics.survival.Quantile(0.5);
+            point.radius = (double)causality.radius / max((int64_t)1, causality.faults);
+            sweep[point.faults] = point;
+        }
+        if (round == rounds){
+            break;
+        }
+
+        // Bisect the intervals that changed most among those that can still be split.
+        vector< pair<double, int> > change;
+        for (map<int, DensityPoint>::iterator a = sweep.begin(), b = ++sweep.begin(); b != sweep.end(); ++a, ++b){
+            if ((a->first >= low) && (b->first <= high) && (b->first - a->first > 1)){
+                change.push_back(make_pair(-a->second.Change(b->second), (a->first + b->first) / 2));
+            }
+        }
+        sort(change.begin(), change.end());
+        pending.clear();
+        for (int i = 0; i < min(refine, (int)change.size()); i++){
+            pending.push_back(change[i].second);
+        }
+    }
+
+    cout << TopologyKey(options) << ", " << driver.trials << " trials per point, budget " << driver.budget << '\n';
+    cout << "# faults density stabilized restricted_mean km_p50" << (driver.causality ? " radius" : "") << '\n';
+
+    double steepest = -1;
+    int from = low, to = high;
+    DensityPoint* previous = NULL;
+    for (map<int, DensityPoint>::iterator p = sweep.begin(); p != sweep.end(); ++p){
+        DensityPoint& point = p->second;
+
+        if ((point.faults < low) || (point.faults > high)){
+            continue;
+        }
+        cout << point.faults << ' ' << (double)point.faults / size << ' ' << (double)point.stabilized / point.trials << ' '
+             << point.restrictedMean << ' ' << point.median;
+        if (driver.causality){
+            cout << ' ' << point.radius;
+        }
+        cout << '\n';
+        if ((previous != NULL) && (previous->Change(point) / (point.faults - previous->faults) > steepest)){
+            steepest = previous->Change(point) / (point.faults - previous->faults);
+            from = previous->faults;
+            to = point.faults;
+        }
+        previous = &point;
+    }
+
+    int finest = high - low;
+    for (map<int, DensityPoint>::iterator a = sweep.begin(), b = ++sweep.begin(); b != sweep.end(); ++a, ++b){
+        if ((a->first >= low) && (b->first <= high)){
+            finest = min(finest, b->first - a->first);
+        }
+    }
+    cout << "steepest change between " << from << " and " << to << " faults (density " << (double)from / size << " to "
+         << (double)to / size << ")\n";
+    cout << ran << " trials run, " << cached << " points from the cache; a uniform grid at the finest spacing would take "
+         << (int64_t)driver.trials * ((high - low) / max(1, finest) + 1) << '\n';
+
+    if (!directory.empty()){
+        string temporary = name.str() + ".tmp";
+        ofstream out(temporary.c_str());
+
+        for (map<int, DensityPoint>::iterator p = sweep.begin(); p != sweep.end(); ++p){
+            DensityPoint& point = p->second;
+
+            out << point.faults << ' ' << point.trials << ' ' << point.stabilized << ' ' << point.restrictedMean << ' '
+                << point.median << ' ' << point.radius << '\n';
+        }
+        out.close();
+        if (!out || (rename(temporary.c_str(), name.str().c_str()) != 0)){
+            cerr << "density: cannot write " << name.str() << '\n';
+        }
+    }
+    delete graph;
+    return 0;
+}
+
+/* Regularized incomplete beta function I_x(a, b), by its continued fraction (Lentz). */
+
+double IncompleteBeta(double a, double b, double x){
+    double front, c = 1, d, f;
+
+    if ((x <= 0) || (x >= 1)){
+        return (x <= 0) ? 0 : 1;
+    }
+    if (x > (a + 1) / (a + b + 2)){
+        return 1 - IncompleteBeta(b, a, 1 - x);
+    }
+    front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x)) / a;
+    d = 1 - (a + b) * x / (a + 1);
+    d = 1 / ((fabs(d) < 1e-300) ? 1e-300 : d);
+    f = d;
+    for (int m = 1; m <= 200; m++){
+        for (int half = 0; half < 2; half++){
+            double numerator = (half == 0) ? m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m))
+                                           : -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+
+            d = 1 + numerator * d;
+            d = 1 / ((fabs(d) < 1e-300) ? 1e-300 : d);
+            c = 1 + numerator / c;
+            c = (fabs(c) < 1e-300) ? 1e-300 : c;
+            f *= c * d;
+        }
+        if (fabs(c * d - 1) < 1e-12){
+            break;
+        }
+    }
+    return front * f;
+}
+
+/* One-sided Welch t-test: the probability of seeing means this far below the baseline's
+   if the new samples were not slower. Both sides need at least two samples; with fewer
+   there is no estimate of the noise and the result is 1. */
+
+double SlowdownPValue(const Welford& baseline, const Welford& current){
+    double a, b, t, df;
+
+    if ((baseline.Count() < 2) || (current.Count() < 2)){
+        return 1;
+    }
+    a = baseline.Deviation() * baseline.Deviation() / baseline.Count();
+    b = current.Deviation() * current.Deviation() / current.Count();
+    if (a + b <= 0){
+        return (current.Mean() < baseline.Mean()) ? 0 : 1;
+    }
+    t = (baseline.Mean() - current.Mean()) / sqrt(a + b);
+    df = (a + b) * (a + b) / (a * a / (baseline.Count() - 1) + b * b / (current.Count() - 1));
+    double tail = 0.5 * IncompleteBeta(df / 2, 0.5, df / (df + t * t));
+    return (t > 0) ? tail : 1 - tail;
+}
+
+/* Benchmark results with the machine they were measured on.
+   Each benchmark is a key ("topology/workload/threads" or "engine/name/topology") with one
+   rate sample per repetition, higher being faster. Baselines are stored as text files named
+   baseline-<name> in the engine decision directory; Compare() tests each shared key for a
+   slowdown beyond noise. */
+
+class Benchmarks {
+public:
+    map<string, vector<double> > samples;
+
+    /* CPU, cores and host, frequency governor and compiler with its flags. */
+
+    static string Fingerprint(){
+        ifstream governor("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor");
+        string policy = "unknown";
+        stringstream fingerprint;
+
+        governor >> policy;
+        fingerprint << EngineTuner::Machine() << "; governor " << policy << "; compiler " << __VERSION__;
+#ifdef __OPTIMIZE__
+        fingerprint << ", optimized";
+#endif
+#ifdef __AVX2__
+        fingerprint << ", avx2";
+#endif
+#ifdef __AVX512F__
+        fingerprint << ", avx512";
+#endif
+#ifdef STABILIZATION_FLAGS
+        fingerprint << ", flags " << STABILIZATION_FLAGS;
+#endif
+        return fingerprint.str();
+    }
+
+    static string Path(const string& name){
+        return EngineTuner::Directory() + "/baseline-" + name;
+    }
+
+    void Add(const string& key, double rate){
+        samples[key].push_back(rate);
+    }
+
+    bool Save(const string& name) const {
+        string temporary = Path(name) + ".tmp";
+        ofstream out;
+
+        mkdir(EngineTuner::Directory().c_str(), 0755);
+        out.open(temporary.c_str());
+        out << "# " << Fingerprint() << '\n';
+        for (map<string, vector<double> >::const_iterator b = samples.begin(); b != samples.end(); ++b){
+            out << b->first;
+            for (size_t s = 0; s < b->second.size(); s++){
+                out << ' ' << b->second[s];
+            }
+            out << '\n';
+        }
+        out.close();
+        return out && (rename(temporary.c_str(), Path(name).c_str()) == 0);
+    }
+
+    /* Loads a baseline and its fingerprint. Returns false when there is none. */
+
+    bool Load(const string& name, string& fingerprint){
+        ifstream in(Path(name).c_str());
+        string line;
+
+        if (!getline(in, line) || (line.compare(0, 2, "# ") != 0)){
+            return false;
+        }
+        fingerprint = line.substr(2);
+        while (getline(in, line)){
+            stringstream fields(line);
+            string key;
+            double rate;
+
+            fields >> key;
+            while (fields >> rate){
+                samples[key].push_back(rate);
+            }
+        }
+        return true;
+    }
+
+    /* Reports each benchmark against the baseline. A benchmark is flagged as slower when the
+       Welch test gives p < alpha and the mean rate dropped by more than threshold, so tiny
+       but consistent differences are not reported. A benchmark with fewer than two samples
+       on either side gets no verdict ("insufficient_samples"). Returns the number flagged. */
+
+    int Compare(const Benchmarks& baseline, double alpha, double threshold, ostream& out) const {
+        int slower = 0, shared = 0;
+        double logChange = 0;
+
+        out << "# benchmark baseline_rate rate change_percent p_slower verdict\n";
+        for (map<string, vector<double> >::const_iterator b = samples.begin(); b != samples.end(); ++b){
+            map<string, vector<double> >::const_iterator old = baseline.samples.find(b->first);
+            Welford before, after;
+
+            if (old == baseline.samples.end()){
+                continue;
+            }
+            for (size_t s = 0; s < old->second.size(); s++){
+                before.Add(old->second[s]);
+            }
+            for (size_t s = 0; s < b->second.size(); s++){
+                after.Add(b->second[s]);
+            }
+
+            double change = (before.Mean() > 0) ? after.Mean() / before.Mean() - 1 : 0;
+            double p = SlowdownPValue(before, after);
+            const char* verdict = "same";
+            if ((before.Count() < 2) || (after.Count() < 2)){
+                verdict = "insufficient_samples";
+            }
+            else if ((p < alpha) && (-change > threshold)){
+                verdict = "SLOWER";
+                slower++;
+            }
+            else if ((SlowdownPValue(after, before) < alpha) && (change > threshold)){
+                verdict = "faster";
+            }
+            out << b->first << ' ' << before.Mean() << ' ' << after.Mean() << ' ' << 100 * change << ' ' << p << ' '
+                << verdict << '\n';
+            if ((before.Mean() > 0) && (after.Mean() > 0)){
+                logChange += log(after.Mean() / before.Mean());
+                shared++;
+            }
+        }
+        if (shared > 0){
+            out << "geometric mean change " << 100 * (exp(logChange / shared) - 1) << "% over " << shared << " benchmarks\n";
+        }
+        return slower;
+    }
+};
+
+/* Scaling mode: strong and weak scaling of the parallel MonteCarlo driver.
+   For each topology the driver runs at 1, 2, 4, ... threads up to the maximum, on a fixed
+   number of trials (strong) and on a fixed number of trials per thread (weak). Trial t is
+   seeded from (seed, t), so every strong run does the same work and each weak run extends
+   the previous one. Node updates are scheduler steps, a censored trial counting its budget.
+   Speedup and efficiency compare node updates per second with the single threaded run,
+   and each configuration keeps its fastest of --repeat runs. The single threaded engines
+   follow. Every repetition is a sample for --save (store a baseline) and --compare (test
+   this run against one); with --compare the exit status is 2 when anything got slower. */
+
+int RunScaling(const Options& options){
+    int cores = max(1, (int)thread::hardware_concurrency());
+    int size = options.Get("size", 4096L);
+    int limit = options.Get("max-threads", (long)cores);
+    int strong = options.Get("trials", 256L);
+    int weak = options.Get("trials-per-thread", 64L);
+    int repeat = options.Get("repeat", 3L);
+    bool pin = options.Get("pin", "on") != "off";
+    uint64_t seed = options.Get("seed", 1L);
+    stringstream names(options.Get("topologies", "list,ring,mesh,ws,ba"));
+    string name;
+    vector<int> counts;
+    Benchmarks benchmarks;
+
+    if ((size < 4) || (limit < 1) || (strong < 1) || (weak < 1) || (repeat < 1)){
+        cerr << "scaling: expected size >= 4, max-threads, trials, trials-per-thread and repeat >= 1\n";
+        return 1;
+    }
+    if ((options.Has("save") || options.Has("compare")) && (repeat < 2)){
+        cerr << "scaling: --save and --compare need --repeat >= 2 to estimate the noise\n";
+        return 1;
+    }
+    for (int t = 1; t < limit; t *= 2){
+        counts.push_back(t);
+    }
+    counts.push_back(limit);
+
+    cout << "# " << Benchmarks::Fingerprint() << ", threads " << (pin ? "pinned" : "unpinned") << '\n';
+    cout << "# topology workload threads trials seconds node_updates_per_sec speedup efficiency\n";
+    while (getline(names, name, ',')){
+        int side = max(2, (int)sqrt((double)size));
+        Graph* graph = (name == "list") ? Graph::List(size) :
+                       (name == "ring") ? Graph::Ring(size) :
+                       (name == "mesh") ? Graph::Mesh(side, side) :
+                       (name == "ws")   ? Graph::WattsStrogatz(size, 6, 0.1, seed, cores) :
+                       (name == "ba")   ? Graph::BarabasiAlbert(size, 4, seed, cores) : NULL;
+
+        if (graph == NULL){
+            cerr << "scaling: unknown topology " << name << '\n';
+            return 1;
+        }
+        for (int workload = 0; workload < 2; workload++){
+            double base = 0;
+
+            for (size_t c = 0; c < counts.size(); c++){
+                MonteCarlo driver(*graph, counts[c]);
+                double best = 0;
+                int64_t updates = 0;
+                stringstream key;
+
+                driver.faults = options.Get("faults", 2L);
+                driver.budget = options.Get("budget", 100000L);
+                driver.seed = seed;
+                driver.pin = pin;
+                driver.trials = (workload == 0) ? strong : weak * counts[c];
+                key << name << '/' << ((workload == 0) ? "strong" : "weak") << '/' << counts[c];
+                for (int r = 0; r < repeat; r++){
+                    double start = Microseconds();
+                    TrialTotals totals = driver.Run();
+                    double elapsed = (Microseconds() - start) / 1e6;
+
+                    updates = totals.steps + (int64_t)(driver.trials - totals.stabilized) * driver.budget;
+                    benchmarks.Add(key.str(), (elapsed > 0) ? updates / elapsed : 0);
+                    if ((best == 0) || (elapsed < best)){
+                        best = elapsed;
+                    }
+                }
+
+                double rate = (best > 0) ? updates / best : 0;
+                if (c == 0){
+                    base = rate;
+                }
+                cout << name << ' ' << ((workload == 0) ? "strong" : "weak") << ' ' << counts[c] << ' ' << driver.trials << ' '
+                     << best << ' ' << rate << ' ' << ((base > 0) ? rate / base : 0) << ' '
+                     << ((base > 0) ? rate / base / counts[c] : 0) << '\n';
+            }
+        }
+        delete graph;
+    }
+
+    cout << "# engine topology steps_per_second\n";
+    for (int e = ENGINE_FIXED; e <= ENGINE_SYSTEM; e++){
+        stringstream key;
+        Welford rate;
+
+        key << "engine/" << engineNames[e] << "/list-256";
+        for (int r = 0; r < repeat; r++){
+            benchmarks.Add(key.str(), EngineTuner::Probe((Engine)e, 1, 256, options.Get("faults", 2L), options.Get("budget", 100000L)));
+            rate.Add(benchmarks.samples[key.str()].back());
+        }
+        cout << engineNames[e] << " list-256 " << rate.Mean() << '\n';
+    }
+
+    if (options.Has("save") && !benchmarks.Save(options.Get("save", ""))){
+        cerr << "scaling: cannot write " << Benchmarks::Path(options.Get("save", "")) << '\n';
+        return 1;
+    }
+    if (options.Has("compare")){
+        Benchmarks baseline;
+        string fingerprint;
+
+        if (!baseline.Load(options.Get("compare", ""), fingerprint)){
+            cerr << "scaling: no baseline " << Benchmarks::Path(options.Get("compare", "")) << '\n';
+            return 1;
+        }
+        if (fingerprint != Benchmarks::Fingerprint()){
+            cout << "# warning: baseline measured on " << fingerprint << '\n';
+        }
+        int slower = benchmarks.Compare(baseline, atof(options.Get("alpha", "0.01").c_str()),
+                                        atof(options.Get("threshold", "0.02").c_str()), cout);
+        cout << slower << " benchmarks slower than baseline " << options.Get("compare", "") << '\n';
+        return (slower > 0) ? 2 : 0;
+    }
+    return 0;
+}
+
+/* STREAM-like triad a[i] = b[i] + s c[i] over arrays of megabytes each, on threads threads.
+   Arrays are first touched by the threads that use them. Returns the best of five passes in
+   bytes per second, counting 24 bytes per element as STREAM does, or 0 when no pass could
+   be timed. megabytes must be at least 1. */
+
+double StreamBandwidth(int megabytes, int threads){
+    int64_t n = (int64_t)megabytes * 1048576 / sizeof(double);
+    vector<double> a, b, c;
+    double best = 0;
+
+    a.resize(n);
+    b.resize(n);
+    c.resize(n);
+    ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+        for (int64_t i = begin; i < end; i++){
+            a[i] = 0;
+            b[i] = 1;
+            c[i] = 2;
+        }
+    });
+    for (int pass = 0; pass < 5; pass++){
+        double start = Microseconds();
+
+        ParallelFor(threads, n, [&](int, int64_t begin, int64_t end){
+            double* x = &a[0];
+            const double* y = &b[0];
+            const double* z = &c[0];
+
+            for (int64_t i = begin; i < end; i++){
+                x[i] = y[i] + 3.0 * z[i];
+            }
+        });
+        double seconds = (Microseconds() - start) / 1e6;
+
+        if (seconds > 0){
+            best = max(best, 24.0 * n / seconds);
+        }
+    }
+    return (a[n / 2] == 7.0) ? best : 0;
+}
+
+/* Pointer chase over a random cycle through megabytes of 64 byte lines: every load depends
+   on the previous one, so the time per hop is the latency of a random access at that
+   working set size. Returns nanoseconds per hop. */
+
+double ChaseLatency(int megabytes){
+    int64_t lines = max((int64_t)2, (int64_t)megabytes * 1048576 / 64);
+    int64_t stride = 64 / sizeof(int64_t);
+    vector<int64_t> next(lines * stride);
+    Random random(7);
+    int64_t at = 0, hops = 20000000;
+
+    // Sattolo's shuffle gives a single cycle through every line.
+    vector<int64_t> order(lines);
+    for (int64_t i = 0; i < lines; i++){
+        order[i] = i;
+    }
+    for (int64_t i = lines - 1; i > 0; i--){
+        swap(order[i], order[(int64_t)((random.Next() >> 11) % (uint64_t)i)]);
+    }
+    for (int64_t i = 0; i < lines; i++){
+        next[order[i] * stride] = order[(i + 1) % lines] * stride;
+    }
+
+    double start = Microseconds();
+    for (int64_t h = 0; h < hops; h++){
+        at = next[at];
+    }
+    double elapsed = Microseconds() - start;
+    return (at >= 0) ? elapsed * 1000 / hops : 0;
+}
+
+/* Roofline mode: how far the engines are from the machine's memory limits.
+   Measures peak bandwidth (STREAM-like triad on all threads) and random access latency
+   (pointer chase), then runs System on the topology serially and MonteCarlo on all threads.
+   Bytes per node update come from a model of the 64 byte lines a step touches: the
+   selected node, and for a rule firing the offsets, the adjacency list and each neighbor.
+   Rule counts come from a heatmap of a sample run. The lines are counted as if each one
+   missed, so the bandwidth is an upper bound on DRAM traffic. The serial engine issues
+   independent random accesses, so its time per update is also compared with the chase
+   latency; a ratio below one means misses overlap. FixedSystem is reported for reference,
+   its state fits in L1. */
+
+int RunRoofline(const Options& options){
+    int cores = max(1, (int)thread::hardware_concurrency());
+    int threads = options.Get("threads", (long)cores);
+    long streamMegabytes = options.Get("stream-mb", 64L);
+    long chaseMegabytes = options.Get("chase-mb", 256L);
+    Graph* graph;
+
+    if ((threads < 1) || (streamMegabytes < 1) || (chaseMegabytes < 1) || (streamMegabytes > 65536) || (chaseMegabytes > 65536)){
+        cerr << "roofline: expected threads >= 1 and 1 <= stream-mb, chase-mb <= 65536\n";
+        return 1;
+    }
+    graph = LoadTopology(options);
+    if (graph == NULL){
+        cerr << "roofline: cannot build " << TopologyKey(options) << '\n';
+        return 1;
+    }
+
+    double stream = StreamBandwidth(streamMegabytes, threads);
+    double chase = ChaseLatency(chaseMegabytes);
+    cout << "machine: " << EngineTuner::Machine() << '\n';
+    cout << "peak: stream triad " << stream / 1e9 << " GB/s on " << threads << " threads, pointer chase "
+         << chase << " ns per dependent load\n";
+
+    // Lines touched per update, from the rule counts of a sample run.
+    MonteCarlo sample(*graph, threads);
+    sample.faults = options.Get("faults", 2L);
+    sample.budget = options.Get("budget", 10L * graph->Size());
+    sample.trials = max(1L, options.Get("trials", (long)threads) / 4);
+    sample.seed = options.Get("seed", 1L);
+    sample.heatmaps = true;
+    sample.Run();
+
+    vector<Heatmap::Entry> active = sample.MergedHeatmap()->Active();
+    double selected = 0, fired = 0, lines = 0;
+    for (size_t e = 0; e < active.size(); e++){
+        double firings = active[e].count[Heatmap::FLIPPED] + active[e].count[Heatmap::RULE_2B];
+
+        selected += active[e].count[Heatmap::SELECTED];
+        fired += firings;
+        lines += active[e].count[Heatmap::SELECTED] + firings * (2 + graph->Degree(active[e].node));
+    }
+    double bytes = 64 * lines / max(1.0, selected);
+    cout << TopologyKey(options) << ": " << bytes << " bytes (" << bytes / 64 << " lines) per node update, "
+         << 100 * fired / max(1.0, selected) << "% of updates fire a rule\n";
+
+    cout << "# engine threads updates_per_sec ns_per_update achieved_GB/s percent_of_stream ns_per_update_over_chase\n";
+    for (int parallel = 0; parallel < 2; parallel++){
+        MonteCarlo driver(*graph, parallel ? threads : 1);
+
+        driver.faults = sample.faults;
+        driver.budget = sample.budget;
+        driver.trials = options.Get("trials", (long)threads);
+        driver.seed = sample.seed;
+        driver.pin = true;
+
+        double start = Microseconds();
+        TrialTotals totals = driver.Run();
+        double seconds = (Microseconds() - start) / 1e6;
+        double updates = totals.steps + (double)(driver.trials - totals.stabilized) * driver.budget;
+        double rate = (seconds > 0) ? updates / seconds : 0;
+        double nanoseconds = (rate > 0) ? 1e9 / rate : 0;
+
+        // A zero rate or bandwidth (nothing measurable) reports 0 rather than inf.
+        cout << (parallel ? "montecarlo " : "system ") << (parallel ? threads : 1) << ' ' << rate << ' ' << nanoseconds << ' '
+             << rate * bytes / 1e9 << ' ' << ((stream > 0) ? 100 * rate * bytes / stream : 0) << ' '
+             << ((chase > 0) ? nanoseconds / chase : 0) << '\n';
+    }
+    cout << "fixed-256 1 " << EngineTuner::Probe(ENGINE_FIXED, 1, 256, sample.faults, 100000)
+         << " (state in L1, not memory bound)\n";
+    delete graph;
+    return 0;
+}
+
+/* Train mode: a representative workload for profile-guided optimization.
+   Runs the trial drivers the other modes use (MonteCarlo on every topology type with and
+   without heatmaps and causality, the FixedSystem sizes, and pipeline site trials on both
+   engines) at small and large sizes and light to heavy fault counts, so that the profile
+   weights the branches of Stabilize as real sweeps do. --scale multiplies the trials. */
+
+int RunTrain(const Options& options){
+    int scale = max(1L, options.Get("scale", 1L));
+    int threads = options.Get("threads", (long)max(1, (int)thread::hardware_concurrency()));
+    const char* types[] = { "list", "ring", "mesh", "tree", "ws", "ba", "config" };
+    int sizes[] = { 256, 4096 };
+    double start = Microseconds();
+    int64_t updates = 0;
+
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++){
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+            int faults[] = { 1, 4, sizes[s] / 16 };
+            int side = (int)sqrt((double)sizes[s]);
+            Graph* graph = (strcmp(types[t], "list") == 0) ? Graph::List(sizes[s]) :
+                           (strcmp(types[t], "ring") == 0) ? Graph::Ring(sizes[s]) :
+                           (strcmp(types[t], "mesh") == 0) ? Graph::Mesh(side, side) :
+                           (strcmp(types[t], "tree") == 0) ? Graph::Tree(sizes[s]) :
+                           (strcmp(types[t], "ws") == 0)   ? Graph::WattsStrogatz(sizes[s], 6, 0.1, 1, threads) :
+                           (strcmp(types[t], "ba") == 0)   ? Graph::BarabasiAlbert(sizes[s], 4, 1, threads) :
+                                                             Graph::Configuration(sizes[s], 2.5, 2, sizes[s] / 4, 1, threads);
+
+            for (int f = 0; f < 3; f++){
+                MonteCarlo driver(*graph, threads);
+                TrialTotals totals;
+
+                driver.faults = faults[f];
+                driver.trials = 64 * scale;
+                driver.budget = 20L * sizes[s];
+                driver.seed = MixSeed(1, t * 16 + s, f);
+                driver.heatmaps = (f == 1);
+                driver.causality = (f == 1) && (s == 0);
+                totals = driver.Run();
+                updates += totals.steps + (int64_t)(driver.trials - totals.stabilized) * driver.budget;
+            }
+            delete graph;
+        }
+    }
+
+    // The fixed engines of trials and the site trials of pipeline.
+    for (int size = 8; size <= 256; size *= 2){
+        for (int faults = 1; faults <= 4; faults *= 2){
+            Random random(MixSeed(2, size, faults));
+            vector<int> sites((size_t)faults * 64 * scale);
+            TrialTotals totals = { 0, 0 };
+            TrialStatistics statistics;
+            System graph(size);
+
+            for (size_t i = 0; i < sites.size(); i++){
+                sites[i] = random.Below(size);
+            }
+            FixedSiteTrials(size, 1, &sites[0], faults, 64 * scale, 20L * size, totals, statistics);
+            graph.Seed(1);
+            SiteTrials(graph, &sites[0], faults, 64 * scale, 20L * size, totals, statistics);
+            // totals holds the trials of both engines.
+            updates += totals.steps + (int64_t)(2 * 64 * scale - totals.stabilized) * 20L * size;
+        }
+    }
+
+    double seconds = (Microseconds() - start) / 1e6;
+    cout << "trained on " << updates << " node updates in " << seconds << " seconds\n";
+    return 0;
+}
+
+void print();
+
+/* Usage:
+     Stabilization                                          interactive single run
+     Stabilization trials <size> <faults> <n> [budget] [seed]
+                                                            batch of n quiet trials
+     Stabilization pipeline [--sizes a,b] [--faults a,b] [--trials n] [--budget steps]
+                            [--workers n] [--builders n] [--generators n] [--chunk n]
+                            [--seed s] [--out file]         staged sweep
+     Stabilization serve [--socket path] [--threads n] [--chunk n] [--max-size n]
+                                                            simulation service
+     Stabilization submit <socket> <request...>             send one request to the service
+     Stabilization topology [--topology list|ring|tree|mesh|ws|ba|config] [--size n] ...
+                            [--cache dir]                   build or map a cached topology, see TopologyKey()
+     Stabilization partition <topology options> [--parts k] [--threads n] [--tolerance 1.03]
+                                                            multilevel partition of a topology
+     Stabilization run <topology options> [--faults f] [--trials n] [--budget steps] [--seed s]
+                       [--threads n] [--heatmap on] [--causality on] [--results file] [--survival file]
+                       [--trace-every n | --trace-us t] [--trace-capacity n] [--trace file]
+                       [--watch predicate>limit:action,...] [--watch-capacity n] [--watch-out file]
+                       [--progress seconds] [--safe-points steps] [--dump prefix] [--replay activation log]
+                       [--scheduler random|fair|central] [--fairness k]
+                                                            parallel trials of System on a topology
+     Stabilization report <sweep file> [--metric mean_steps] [--out dir] [--bootstrap n] [--threads n]
+                                                            scaling-law fits of a pipeline sweep
+     Stabilization tune <topology options> [--faults f] [--objective steps|radius] [--candidates n] [--trials n]
+                        [--eta n] [--m lo,hi] [--increment lo,hi] [--initial lo,hi]
+                                                            searches the rule constants
+     Stabilization density <topology options> [--min-faults f] [--max-faults f] [--points n] [--rounds r]
+                           [--refine k] [--trials n] [--causality on]
+                                                            adaptive fault density sweep
+     Stabilization scaling [--topologies list,ring,mesh,ws,ba] [--size n] [--max-threads n] [--trials n]
+                           [--trials-per-thread n] [--repeat n] [--pin on|off] [--save name]
+                           [--compare name] [--alpha p] [--threshold fraction]
+                                                            strong and weak scaling benchmark
+     Stabilization roofline <topology options> [--faults f] [--trials n] [--stream-mb n] [--chase-mb n]
+                                                            engines against memory bandwidth and latency
+     Stabilization train [--scale n]                        profile-guided optimization workload */
+
+int main(int argc, char* argv[])
+{
     srand(time(NULL));
+
+    if ((argc >= 5) && (strcmp(argv[1], "trials") == 0)){
+        return RunTrials(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), (argc > 5) ? atol(argv[5]) : 1000000,
+                         (argc > 6) ? strtoull(argv[6], NULL, 10) : (uint64_t)rand());
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "pipeline") == 0)){
+        return RunPipeline(Options(argc, argv, 2));
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "serve") == 0)){
+        return RunServer(Options(argc, argv, 2));
+    }
+    if ((argc >= 4) && (strcmp(argv[1], "submit") == 0)){
+        string request = argv[3];
+
+        for (int i = 4; i < argc; i++){
+            request += string(" ") + argv[i];
+        }
+        return RunClient(argv[2], request);
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "topology") == 0)){
+        return RunTopology(Options(argc, argv, 2));
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "partition") == 0)){
+        return RunPartition(Options(argc, argv, 2));
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "run") == 0)){
+        return RunGraph(Options(argc, argv, 2));
+    }
+    if ((argc >= 3) && (strcmp(argv[1], "report") == 0)){
+        return RunReport(argv[2], Options(argc, argv, 3));
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "tune") == 0)){
+        return RunTune(Options(argc, argv, 2));
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "density") == 0)){
+        return RunDensity(Options(argc, argv, 2));
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "scaling") == 0)){
+        return RunScaling(Options(argc, argv, 2));
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "roofline") == 0)){
+        return RunRoofline(Options(argc, argv, 2));
+    }
+    if ((argc >= 2) && (strcmp(argv[1], "train") == 0)){
+        return RunTrain(Options(argc, argv, 2));
+    }
+
     boost::posix_time::ptime start, stop;
     boost::posix_time::time_duration time;
     int size, faults;